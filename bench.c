@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "rapl.h"
+#include "rtclock.h"
+
+// operations a timed run's threads do between looks at the clock
+#define BENCH_CLOCK_EVERY 256
+
+// Everything one worker thread needs, and what it counted: operations
+// done, gets and how many of them found their key, and the latency samples
+// (room for maxLatencies). A timed run stops at deadline (ns).
+typedef struct worker_t {
+  ts_hashmap_t *map;
+  const ts_workload_t *wl;
+  int id;
+  pthread_barrier_t *start;
+  long deadline;
+  long ops;
+  long gets;
+  long hits;
+  long *latencies;
+  long numLatencies;
+  long maxLatencies;
+} worker_t;
+
+static long now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * A per-thread xorshift generator, so workers don't serialize on rand()'s
+ * internal lock and skew the numbers.
+ */
+static unsigned next_rand(unsigned *state) {
+  unsigned x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+ * Runs one operation, timing it if it's the thread's turn to take a
+ * latency sample.
+ */
+static void run_op(worker_t *w, long i, int op, int key, int value) {
+  int sampled = w->latencies != NULL && i % w->wl->sampleEvery == 0;
+  long start = sampled ? now_ns() : 0;
+  if (op == BENCH_PUT) {
+    put(w->map, key, value);
+  } else if (op == BENCH_GET) {
+    w->gets++;
+    w->hits += get(w->map, key) != INT_MAX;
+  } else {
+    del(w->map, key);
+  }
+  if (sampled) {
+    // a timed run can't know up front how many samples it will take
+    if (w->numLatencies == w->maxLatencies) {
+      w->maxLatencies *= 2;
+      w->latencies = (long*) realloc(w->latencies, w->maxLatencies * sizeof(long));
+    }
+    w->latencies[w->numLatencies++] = now_ns() - start;
+  }
+}
+
+/**
+ * Runs one thread's share of a synthetic workload or a trace.
+ */
+static void *worker(void *args) {
+  worker_t *w = (worker_t*) args;
+  const ts_workload_t *wl = w->wl;
+  unsigned seed = 2463534242u + 7919u * w->id;
+  pthread_barrier_wait(w->start);
+  if (wl->trace != NULL) {
+    for (long i = w->id; i < wl->traceLen; i += wl->threads) {
+      bench_op_t *op = &wl->trace[i];
+      run_op(w, i / wl->threads, op->op, op->key, op->value);
+      w->ops++;
+    }
+    return NULL;
+  }
+  for (long i = 0; wl->seconds > 0 || i < wl->opsPerThread; i++) {
+    if (wl->seconds > 0 && i % BENCH_CLOCK_EVERY == 0 && now_ns() >= w->deadline) {
+      break;
+    }
+    int r = next_rand(&seed) % 100;
+    int key;
+    if (wl->hotKeys > 0 && (int) (next_rand(&seed) % 100) < wl->hotPct) {
+      key = (wl->hotBase + next_rand(&seed) % wl->hotKeys) % wl->keyRange;
+    } else {
+      key = next_rand(&seed) % wl->keyRange;
+    }
+    int op = r < wl->getPct ? BENCH_GET : r < wl->getPct + wl->putPct ? BENCH_PUT : BENCH_DEL;
+    run_op(w, i, op, key, key);
+    w->ops++;
+  }
+  return NULL;
+}
+
+static int compare_long(const void *a, const void *b) {
+  long x = *(const long*) a;
+  long y = *(const long*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Gathers the workers' latency samples into a run's percentiles.
+ */
+static void latency_stats(worker_t *workers, int threads, bench_result_t *result) {
+  long total = 0;
+  for (int i = 0; i < threads; i++) {
+    total += workers[i].numLatencies;
+  }
+  result->samples = total;
+  result->p50Ns = result->p99Ns = result->p999Ns = result->maxNs = 0;
+  if (total == 0) {
+    return;
+  }
+  long *all = (long*) malloc(total * sizeof(long));
+  long n = 0;
+  for (int i = 0; i < threads; i++) {
+    memcpy(all + n, workers[i].latencies, workers[i].numLatencies * sizeof(long));
+    n += workers[i].numLatencies;
+  }
+  qsort(all, total, sizeof(long), compare_long);
+  result->p50Ns = all[total / 2];
+  result->p99Ns = all[total * 99 / 100];
+  result->p999Ns = all[total * 999 / 1000];
+  result->maxNs = all[total - 1];
+  free(all);
+}
+
+/**
+ * Returns the number of CPUs the process may run on, as its affinity mask
+ * (or the cpuset of its container) allows.
+ */
+int bench_cpus(void) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return 1;
+  }
+  return CPU_COUNT(&allowed);
+}
+
+/**
+ * Fills half of the workload's key range, so gets and dels start out
+ * hitting about half the time instead of running against an empty map.
+ */
+void bench_prefill(ts_hashmap_t *map, const ts_workload_t *wl) {
+  for (int key = 0; key < wl->keyRange; key += 2) {
+    put(map, key, key);
+  }
+}
+
+/**
+ * Runs a workload against a map and measures it. All threads are released
+ * together once they're created, so thread startup isn't timed. With
+ * wl->cpus set the threads all run on the first that many of the CPUs the
+ * process may use, the way a container's cpuset would hold them. With
+ * wl->seconds set they run for that long instead of for opsPerThread
+ * operations each. Where RAPL counters are readable the run's energy is
+ * measured too.
+ * @param map a pointer to the map
+ * @param wl the workload to run
+ * @param result where to store the measurements
+ */
+void bench_run(ts_hashmap_t *map, const ts_workload_t *wl, bench_result_t *result) {
+  pthread_t *threads = (pthread_t*) malloc(wl->threads * sizeof(pthread_t));
+  worker_t *workers = (worker_t*) malloc(wl->threads * sizeof(worker_t));
+  pthread_barrier_t start;
+  pthread_barrier_init(&start, NULL, wl->threads + 1);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (wl->cpus > 0) {
+    cpu_set_t allowed, cpus;
+    CPU_ZERO(&cpus);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0, n = 0; cpu < CPU_SETSIZE && n < wl->cpus; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        CPU_SET(cpu, &cpus);
+        n++;
+      }
+    }
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  long perThread = wl->trace != NULL ? wl->traceLen / wl->threads + 1 : wl->opsPerThread;
+  for (int i = 0; i < wl->threads; i++) {
+    workers[i].map = map;
+    workers[i].wl = wl;
+    workers[i].id = i;
+    workers[i].start = &start;
+    workers[i].ops = 0;
+    workers[i].gets = 0;
+    workers[i].hits = 0;
+    workers[i].latencies = NULL;
+    workers[i].numLatencies = 0;
+    workers[i].maxLatencies = 0;
+    if (wl->sampleEvery > 0) {
+      workers[i].maxLatencies = wl->seconds > 0 ? 4096 : perThread / wl->sampleEvery + 1;
+      workers[i].latencies = (long*) malloc(workers[i].maxLatencies * sizeof(long));
+    }
+    pthread_create(&threads[i], &attr, worker, &workers[i]);
+  }
+  pthread_attr_destroy(&attr);
+  long deadline = now_ns() + (long) (wl->seconds * 1e9);
+  for (int i = 0; i < wl->threads; i++) {
+    workers[i].deadline = deadline;
+  }
+  rapl_t meter;
+  rapl_open(&meter);
+  rapl_start(&meter);
+  double startTime = rtclock();
+  pthread_barrier_wait(&start);
+  for (int i = 0; i < wl->threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double endTime = rtclock();
+  result->joules = rapl_stop(&meter);
+  rapl_close(&meter);
+  pthread_barrier_destroy(&start);
+  result->ops = 0;
+  result->gets = 0;
+  result->hits = 0;
+  for (int i = 0; i < wl->threads; i++) {
+    result->ops += workers[i].ops;
+    result->gets += workers[i].gets;
+    result->hits += workers[i].hits;
+  }
+  result->seconds = endTime - startTime;
+  result->opsPerSec = result->ops / result->seconds;
+  latency_stats(workers, wl->threads, result);
+  for (int i = 0; i < wl->threads; i++) {
+    free(workers[i].latencies);
+  }
+  free(threads);
+  free(workers);
+}
+
+/**
+ * Reads a workload from a file. A description is a list of name=value
+ * settings (threads, keys, get, put, ops, hotkeys, hotpct, hotbase, seconds,
+ * cpus, sample); a captured trace has one operation per line: "g <key>",
+ * "p <key> <value>" or "d <key>".
+ * A trace may start with a threads= line; the key range is taken from it.
+ * @param path the file to read
+ * @param wl the workload to fill in
+ * @return 0 on success, -1 if the file can't be read
+ */
+int bench_load(const char *path, ts_workload_t *wl) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  memset(wl, 0, sizeof(ts_workload_t));
+  wl->threads = 4;
+  wl->keyRange = 100000;
+  wl->getPct = 80;
+  wl->putPct = 15;
+  wl->opsPerThread = 100000;
+  long capacity = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char op;
+    int key;
+    int value = 0;
+    long number;
+    char name[64];
+    if (sscanf(line, "%63[a-z]=%ld", name, &number) == 2) {
+      if (strcmp(name, "threads") == 0) wl->threads = number;
+      else if (strcmp(name, "keys") == 0) wl->keyRange = number;
+      else if (strcmp(name, "get") == 0) wl->getPct = number;
+      else if (strcmp(name, "put") == 0) wl->putPct = number;
+      else if (strcmp(name, "ops") == 0) wl->opsPerThread = number;
+      else if (strcmp(name, "hotkeys") == 0) wl->hotKeys = number;
+      else if (strcmp(name, "hotpct") == 0) wl->hotPct = number;
+      else if (strcmp(name, "hotbase") == 0) wl->hotBase = number;
+      else if (strcmp(name, "seconds") == 0) wl->seconds = number;
+      else if (strcmp(name, "cpus") == 0) wl->cpus = number;
+      else if (strcmp(name, "sample") == 0) wl->sampleEvery = number;
+    } else if (sscanf(line, " %c %d %d", &op, &key, &value) >= 2 && strchr("gpd", op) != NULL) {
+      if (wl->traceLen == capacity) {
+        capacity = capacity ? capacity * 2 : 4096;
+        wl->trace = (bench_op_t*) realloc(wl->trace, capacity * sizeof(bench_op_t));
+      }
+      bench_op_t *o = &wl->trace[wl->traceLen++];
+      o->op = op == 'g' ? BENCH_GET : op == 'p' ? BENCH_PUT : BENCH_DEL;
+      o->key = key;
+      o->value = value;
+    }
+  }
+  fclose(file);
+  // size a trace's key range from the largest key it touches
+  if (wl->trace != NULL) {
+    wl->keyRange = 1;
+    for (long i = 0; i < wl->traceLen; i++) {
+      if (wl->trace[i].key >= wl->keyRange) {
+        wl->keyRange = wl->trace[i].key + 1;
+      }
+    }
+  }
+  return 0;
+}
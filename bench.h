@@ -0,0 +1,76 @@
+/*
+ * bench.h
+ *
+ * Reusable benchmark harness: runs a workload against a map with a pool of
+ * threads and reports its throughput. A workload is either synthetic (an
+ * operation mix over a key range, optionally with a hot set) or a captured
+ * trace of operations that is replayed as-is.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "ts_hashmap.h"
+
+// operations in a captured trace
+#define BENCH_GET 0
+#define BENCH_PUT 1
+#define BENCH_DEL 2
+
+// One operation of a captured trace
+typedef struct bench_op_t {
+   int op;
+   int key;
+   int value;
+} bench_op_t;
+
+// A workload: how many threads run how many operations each, over which
+// keys, in what mix. hotKeys/hotPct send hotPct% of operations to the
+// hotKeys keys from hotBase on (wrapping around the key range), and
+// seconds, if set, runs the threads for that long instead of for
+// opsPerThread operations each. When trace is set the mix is ignored and the trace
+// is dealt out round-robin to the threads instead. cpus confines the
+// threads to that many of the CPUs the process may use (0 for all of them),
+// so a run can have more threads than cores; sampleEvery times every so
+// many operations of each thread to measure latency (0 for none).
+typedef struct ts_workload_t {
+   int threads;
+   int keyRange;
+   int getPct;
+   int putPct;
+   long opsPerThread;
+   int hotKeys;
+   int hotPct;
+   int hotBase;
+   double seconds;
+   bench_op_t *trace;
+   long traceLen;
+   int cpus;
+   int sampleEvery;
+} ts_workload_t;
+
+// The outcome of a run: the operations done, how many of them were gets
+// and how many gets found their key, and with sampleEvery set, also the
+// sampled operations' latency percentiles and the slowest of them, in
+// nanoseconds. joules is the energy the CPU packages used over the run,
+// or -1 where RAPL isn't exposed (see rapl.h).
+typedef struct bench_result_t {
+   long ops;
+   double seconds;
+   double opsPerSec;
+   long gets;
+   long hits;
+   long samples;
+   double p50Ns;
+   double p99Ns;
+   double p999Ns;
+   double maxNs;
+   double joules;
+} bench_result_t;
+
+void bench_prefill(ts_hashmap_t*, const ts_workload_t*);
+void bench_run(ts_hashmap_t*, const ts_workload_t*, bench_result_t*);
+int bench_load(const char*, ts_workload_t*);
+int bench_cpus(void);
+
+#endif /* BENCH_H_ */
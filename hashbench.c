@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rtclock.h"
+#include "ts_simd.h"
+
+// keys hashed per call; small enough to stay in L1 so we time the kernel
+#define BATCH 1024
+
+// a sink the compiler can't prove unused
+volatile int sink = 0;
+
+/**
+ * Times one batch kernel on a single core.
+ * @return millions of keys hashed per second
+ */
+double time_kernel(int which, const ts_kernels_t *k, const int *keys, int *buckets, long total) {
+	long rounds = total / BATCH;
+	double start = rtclock();
+	for (long r = 0; r < rounds; r++) {
+		switch (which) {
+			case 0: k->hash_batch(keys, buckets, BATCH, 1000003); break;
+			case 1: k->mult_batch(keys, buckets, BATCH, (1 << 20) - 1); break;
+			default: k->murmur_batch(keys, buckets, BATCH, (1 << 20) - 1); break;
+		}
+		sink += buckets[r & (BATCH - 1)];
+	}
+	double elapsed = rtclock() - start;
+	return rounds * BATCH / elapsed / 1e6;
+}
+
+/**
+ * Hashing throughput per core for every hash function and every
+ * instruction set level this CPU supports.
+ */
+int main(int argc, char *argv[]) {
+	long total = argc > 1 ? atol(argv[1]) : 100000000L;
+	const char *names[] = { "modulo", "mult", "murmur" };
+	int *keys = (int*) malloc(BATCH * sizeof(int));
+	int *buckets = (int*) malloc(BATCH * sizeof(int));
+	srand(1);
+	for (int i = 0; i < BATCH; i++) {
+		keys[i] = rand();
+	}
+
+	printf("%-8s", "hash");
+	for (int level = 0; level < SIMD_LEVELS; level++) {
+		const ts_kernels_t *k = simd_kernels(level);
+		if (k != NULL) {
+			printf(" %12s", k->name);
+		}
+	}
+	printf("   (Mkeys/s/core, best = %s)\n", simd_kernels(simd_level())->name);
+
+	for (int which = 0; which < 3; which++) {
+		printf("%-8s", names[which]);
+		for (int level = 0; level < SIMD_LEVELS; level++) {
+			const ts_kernels_t *k = simd_kernels(level);
+			if (k != NULL) {
+				printf(" %12.1f", time_kernel(which, k, keys, buckets, total));
+			}
+		}
+		printf("\n");
+	}
+	free(keys);
+	free(buckets);
+	return 0;
+}
@@ -0,0 +1,172 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "ts_hlog.h"
+
+// pages the log keeps in memory: few enough that most of the keys end up
+// on disk only, so reads have to go to the file
+#define PAGES 16
+
+// One thread's keys (key k * threads + id for each k) and what the log
+// should hold for them
+typedef struct hlog_worker_t {
+	int id;
+	int *values;
+} hlog_worker_t;
+
+// A read handed to the reader thread, and the value it should come back with
+typedef struct hlog_pending_t {
+	int key;
+	int expected;
+} hlog_pending_t;
+
+ts_hlog_t *hlog;
+int threads;
+int keys;
+long ops;
+long wrong = 0;
+long writes = 0;
+long queued = 0;
+long answered = 0;
+
+void read_done(int key, int value, void *arg) {
+	hlog_pending_t *pending = arg;
+	if (key != pending->key || value != pending->expected) {
+		__atomic_fetch_add(&wrong, 1, __ATOMIC_RELAXED);
+	}
+	free(pending);
+	__atomic_fetch_add(&answered, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Inserts all of a thread's keys, then runs a random mix of upserts,
+ * deletes, reads and async reads on them, checking every read against
+ * what it last wrote. No other thread writes its keys, so a read must
+ * see exactly that: an async read that goes to disk is checked against
+ * the value when it was issued, which its record on disk still has.
+ */
+void *worker(void *arg) {
+	hlog_worker_t *w = arg;
+	unsigned seed = w->id + 1;
+	long myWrites = 0;
+	for (int k = 0; k < keys; k++) {
+		hlog_upsert(hlog, k * threads + w->id, k);
+		w->values[k] = k;
+		myWrites++;
+	}
+	for (long i = 0; i < ops; i++) {
+		int k = rand_r(&seed) % keys;
+		int key = k * threads + w->id;
+		int op = rand_r(&seed) % 8;
+		if (op < 3) {
+			int value = rand_r(&seed) % INT_MAX;
+			hlog_upsert(hlog, key, value);
+			w->values[k] = value;
+			myWrites++;
+		} else if (op == 3) {
+			hlog_delete(hlog, key);
+			w->values[k] = INT_MAX;
+			myWrites++;
+		} else if (op < 7) {
+			if (hlog_read(hlog, key) != w->values[k]) {
+				__atomic_fetch_add(&wrong, 1, __ATOMIC_RELAXED);
+			}
+		} else {
+			hlog_pending_t *pending = malloc(sizeof(hlog_pending_t));
+			pending->key = key;
+			pending->expected = w->values[k];
+			int value;
+			if (hlog_read_async(hlog, key, &value, read_done, pending) == EINPROGRESS) {
+				__atomic_fetch_add(&queued, 1, __ATOMIC_RELAXED);
+			} else {
+				if (value != pending->expected) {
+					__atomic_fetch_add(&wrong, 1, __ATOMIC_RELAXED);
+				}
+				free(pending);
+			}
+		}
+	}
+	__atomic_fetch_add(&writes, myWrites, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * Stress tests the HybridLog: threads upsert, delete, read and read
+ * asynchronously their own keys, with so few pages in memory that records
+ * keep moving from the mutable tail to read-only to disk underneath them,
+ * and every read is checked against what the thread last wrote. Then every
+ * key is read once more, and the stats must add up: each write either went
+ * in place or was appended, every record address was appended to or left
+ * empty because its page turned read-only first, the regions cover them
+ * all, and some reads went to disk. Takes the number of threads, the keys
+ * per thread, the operations per thread and the file to spill to as
+ * optional arguments; the file is removed at the end.
+ * @return 0 if every read and the stats were right, 1 otherwise
+ */
+int main(int argc, char *argv[]) {
+	threads = argc > 1 ? atoi(argv[1]) : 4;
+	keys = argc > 2 ? atoi(argv[2]) : 50000;
+	ops = argc > 3 ? atol(argv[3]) : 300000;
+	const char *path = argc > 4 ? argv[4] : "hlogtest.dat";
+	if (threads < 1 || keys < 1 || ops < 0) {
+		printf("usage: %s [threads] [keys per thread] [operations per thread] [file]\n", argv[0]);
+		return 1;
+	}
+	ts_hlog_options_t opts = { .path = path, .capacity = threads * keys, .pages = PAGES };
+	hlog = hlog_init(&opts);
+	if (hlog == NULL) {
+		printf("can't open %s\n", path);
+		return 1;
+	}
+
+	pthread_t tids[threads];
+	hlog_worker_t workers[threads];
+	for (int t = 0; t < threads; t++) {
+		workers[t].id = t;
+		workers[t].values = malloc(sizeof(int) * keys);
+		pthread_create(&tids[t], NULL, worker, &workers[t]);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+	// let the reader answer what's still queued
+	while (__atomic_load_n(&answered, __ATOMIC_RELAXED) < queued) {
+		usleep(1000);
+	}
+	long missed = 0;
+	for (int t = 0; t < threads; t++) {
+		for (int k = 0; k < keys; k++) {
+			missed += hlog_read(hlog, k * threads + t) != workers[t].values[k];
+		}
+		free(workers[t].values);
+	}
+	ts_hlog_stats_t stats;
+	hlog_stats(hlog, &stats);
+	hlog_free(hlog);
+	unlink(path);
+
+	printf("%d threads, %d keys and %ld operations each, %d pages in memory\n", threads, keys, ops, PAGES);
+	printf("%ld writes: %ld in place, %ld appended\n", writes, stats.inPlace, stats.appended);
+	printf("%ld records: %ld mutable, %ld read-only, %ld on disk only, %ld skipped\n",
+			stats.records, stats.mutableRecords, stats.readOnlyRecords, stats.diskRecords, stats.skipped);
+	printf("%ld disk reads, %ld of them async\n", stats.diskReads, queued);
+	printf("%ld reads wrong during the run, %ld keys wrong after it\n", wrong, missed);
+	int failed = wrong != 0 || missed != 0;
+	if (stats.inPlace + stats.appended != writes || stats.appended + stats.skipped != stats.records) {
+		printf("writes don't add up\n");
+		failed = 1;
+	}
+	if (stats.mutableRecords + stats.readOnlyRecords + stats.diskRecords != stats.records) {
+		printf("regions don't add up\n");
+		failed = 1;
+	}
+	if (stats.diskRecords == 0 || stats.diskReads == 0) {
+		printf("nothing reached the disk\n");
+		failed = 1;
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
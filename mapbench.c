@@ -0,0 +1,140 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "perfcount.h"
+#include "rtclock.h"
+#include "ts_hashmap.h"
+
+// lookups per measurement
+#define LOOKUPS 2000000
+
+// keys per bucket, on average
+#define LOAD 4
+
+// a sink the compiler can't prove unused
+volatile int sink = 0;
+
+/**
+ * The head of a bucket's chain, wherever the map's layout keeps it.
+ */
+ts_entry_t *head(ts_hashmap_t *map, int bucket) {
+	if (map->flags & TS_COLOCATE) {
+		return map->stripes[bucket / STRIPE_HEADS].heads[bucket % STRIPE_HEADS];
+	}
+	return map->table[bucket];
+}
+
+/**
+ * How well a map's chains are laid out: the percent of chain hops that go
+ * to the very next entry in memory, and the percent that stay on the same
+ * 4KB page.
+ */
+void chain_layout(ts_hashmap_t *map, double *adjacent, double *samePage) {
+	long hops = 0;
+	long next = 0;
+	long page = 0;
+	for (int i = 0; i < map->capacity; i++) {
+		for (ts_entry_t *e = head(map, i); e != NULL && e->next != NULL; e = e->next) {
+			hops++;
+			next += e->next == e + 1;
+			page += ((uintptr_t) e >> 12) == ((uintptr_t) e->next >> 12);
+		}
+	}
+	*adjacent = hops ? 100.0 * next / hops : 0;
+	*samePage = hops ? 100.0 * page / hops : 0;
+}
+
+/**
+ * Runs random lookups on one thread and reports their speed and, where
+ * the hardware counters are available, their cache misses.
+ */
+void measure(const char *label, ts_hashmap_t *map, int keys) {
+	perfcount_t llc;
+	perfcount_t l1;
+	perfcount_open(&llc, PERF_CACHE_MISSES);
+	perfcount_open(&l1, PERF_L1D_MISSES);
+	unsigned seed = 12345;
+	perfcount_start(&llc);
+	perfcount_start(&l1);
+	double start = rtclock();
+	for (int i = 0; i < LOOKUPS; i++) {
+		sink += get(map, rand_r(&seed) % keys);
+	}
+	double elapsed = rtclock() - start;
+	long llcMisses = perfcount_stop(&llc);
+	long l1Misses = perfcount_stop(&l1);
+	perfcount_close(&llc);
+	perfcount_close(&l1);
+
+	double adjacent, samePage;
+	chain_layout(map, &adjacent, &samePage);
+	printf("%-22s %8.1f %8.1f %10.0f", label, adjacent, samePage, LOOKUPS / elapsed / 1e3);
+	if (llcMisses >= 0) printf(" %10.2f", (double) llcMisses / LOOKUPS);
+	else printf(" %10s", "n/a");
+	if (l1Misses >= 0) printf(" %10.2f\n", (double) l1Misses / LOOKUPS);
+	else printf(" %10s\n", "n/a");
+}
+
+/**
+ * Fills a map and then churns it with random deletes and re-inserts, the
+ * way hours of traffic would, so free entries get reused all over.
+ */
+void age(ts_hashmap_t *map, int keys, long churn) {
+	for (int key = 0; key < keys; key++) {
+		put(map, key, key);
+	}
+	unsigned seed = 42;
+	for (long i = 0; i < churn; i++) {
+		int key = rand_r(&seed) % keys;
+		del(map, key);
+		put(map, rand_r(&seed) % keys, key);
+	}
+}
+
+/**
+ * Compares lookups on an aged map whose entries come from malloc with an
+ * aged TS_LOCALITY map, before and after defragmenting it; then lookups
+ * with the stripe locks in an array of their own, few or many of them,
+ * against TS_COLOCATE, where a bucket's head shares a line with its lock.
+ */
+int main(int argc, char *argv[]) {
+	int keys = argc > 1 ? atoi(argv[1]) : 1000000;
+	long churn = argc > 2 ? atol(argv[2]) : 4L * keys;
+	printf("%d keys, %d per bucket, %ld churn operations, %d lookups\n\n", keys, LOAD, churn, LOOKUPS);
+	printf("%-22s %8s %8s %10s %10s %10s\n", "map", "adj %", "page %", "kget/s", "LLC/get", "L1D/get");
+
+	ts_options_t opts = { .capacity = keys / LOAD };
+	ts_hashmap_t *map = initmap_opts(&opts);
+	age(map, keys, churn);
+	measure("malloc, aged", map, keys);
+	freeMap(map);
+
+	opts.flags = TS_LOCALITY;
+	map = initmap_opts(&opts);
+	age(map, keys, churn);
+	measure("locality, aged", map, keys);
+	int moved = map_defrag(map, map->capacity);
+	measure("locality, defragged", map, keys);
+	printf("\n%d of %d chains moved by the defragmenter\n\n", moved, map->capacity);
+	freeMap(map);
+
+	opts.flags = 0;
+	map = initmap_opts(&opts);
+	age(map, keys, 0);
+	measure("striped, 64 locks", map, keys);
+	freeMap(map);
+
+	opts.numStripes = opts.capacity / STRIPE_HEADS;
+	map = initmap_opts(&opts);
+	age(map, keys, 0);
+	measure("striped, lock per 4", map, keys);
+	freeMap(map);
+
+	opts.flags = TS_COLOCATE;
+	map = initmap_opts(&opts);
+	age(map, keys, 0);
+	measure("colocated", map, keys);
+	freeMap(map);
+	return 0;
+}
@@ -0,0 +1,283 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtclock.h"
+#include "ts_hashmap.h"
+
+// entries in a table small enough to stay in cache, and in one that won't
+#define CACHE_ENTRIES 1024
+#define DRAM_ENTRIES (1 << 22)
+
+// operations timed together, untimed rounds to warm up, and timed rounds
+#define BATCH 4096
+#define WARMUP 3
+#define ROUNDS 21
+
+// chains of this many entries past the real ones hold the missing keys;
+// a thread's new keys go at chain position length + its index, below it
+#define MISS_CHAIN 100
+
+// the operations measured
+enum { GET_HIT, GET_MISS, PUT_UPDATE, PUT_NEW, DEL_HIT, DEL_MISS, NUM_OPS };
+const char *opNames[NUM_OPS] = { "get hit", "get miss", "put update", "put new", "del hit", "del miss" };
+
+// a sink the compiler can't prove unused
+volatile int sink = 0;
+
+// One thread's part in a case: the operation, the keys it runs it on
+// (n a round), the barrier it starts rounds at, and when it started and
+// finished each round's batch
+typedef struct worker_t {
+	ts_hashmap_t *map;
+	int op;
+	int *keys;
+	int n;
+	int rounds;
+	pthread_barrier_t *barrier;
+	double *starts;
+	double *ends;
+} worker_t;
+
+/**
+ * Runs one operation on each of a batch of keys.
+ */
+void run_batch(ts_hashmap_t *map, int op, const int *keys, int n) {
+	for (int i = 0; i < n; i++) {
+		switch (op) {
+			case GET_HIT:
+			case GET_MISS:
+				sink += get(map, keys[i]);
+				break;
+			case PUT_UPDATE:
+			case PUT_NEW:
+				sink += put(map, keys[i], i);
+				break;
+			case DEL_HIT:
+			case DEL_MISS:
+				sink += del(map, keys[i]);
+				break;
+		}
+	}
+}
+
+/**
+ * Puts the map back the way it was before a batch: new keys are deleted
+ * again and deleted ones put back, so every round starts from the same
+ * chains.
+ */
+void undo_batch(ts_hashmap_t *map, int op, const int *keys, int n) {
+	for (int i = 0; i < n; i++) {
+		if (op == PUT_NEW) del(map, keys[i]);
+		else if (op == DEL_HIT) put(map, keys[i], keys[i]);
+	}
+}
+
+/**
+ * A worker thread: each round, waits for the others, runs its batch on
+ * that round's keys, and undoes it untimed. Every thread clocks its own
+ * batch, since with more threads than cores the one that lets them go
+ * may not run again until they're done.
+ */
+void *worker(void *arg) {
+	worker_t *w = arg;
+	for (int r = 0; r < w->rounds; r++) {
+		const int *keys = w->keys + r * w->n;
+		pthread_barrier_wait(w->barrier);
+		w->starts[r] = rtclock();
+		run_batch(w->map, w->op, keys, w->n);
+		w->ends[r] = rtclock();
+		pthread_barrier_wait(w->barrier);
+		undo_batch(w->map, w->op, keys, w->n);
+	}
+	return NULL;
+}
+
+/**
+ * Shuffles an array in place.
+ */
+void shuffle(int *a, int n, unsigned *seed) {
+	for (int i = n - 1; i > 0; i--) {
+		int j = rand_r(seed) % (i + 1);
+		int t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+/**
+ * Picks a thread's keys for every round of an operation on a map whose
+ * buckets each hold the keys bucket + j * buckets for j below length.
+ * Hits are picked at random from those; misses are keys that would be in
+ * the same buckets but aren't; new keys are one per bucket and different
+ * for every thread, and keys to delete are slices of all of them no other
+ * thread has, so that neither repeats within a round. Each round gets
+ * keys of its own where the table has enough, so a big table's rounds
+ * don't find the last round's keys still in cache, and a delete that was
+ * undone (which puts the key back at the head of its chain) isn't timed
+ * again.
+ *
+ * @return the number of keys picked for each round, at most BATCH
+ */
+int pick_keys(int *keys, int op, int buckets, int length, int thread, int threads, int rounds, unsigned *seed) {
+	int n = BATCH;
+	if (op == PUT_NEW) {
+		n = buckets < BATCH ? buckets : BATCH;
+		int *order = malloc(sizeof(int) * buckets);
+		for (int b = 0; b < buckets; b++) order[b] = b;
+		shuffle(order, buckets, seed);
+		for (int i = 0; i < n * rounds; i++) {
+			keys[i] = order[i % buckets] + (length + thread) * buckets;
+		}
+		free(order);
+	} else if (op == DEL_HIT) {
+		int total = buckets * length;
+		n = total / threads < BATCH ? total / threads : BATCH;
+		int *all = malloc(sizeof(int) * total);
+		for (int i = 0; i < total; i++) all[i] = i;
+		// the same shuffle for every thread, so their slices don't overlap
+		unsigned common = 7;
+		shuffle(all, total, &common);
+		int slices = total / n;
+		for (int r = 0; r < rounds; r++) {
+			int slice = (r * threads + thread) % slices;
+			memcpy(keys + r * n, all + slice * n, sizeof(int) * n);
+		}
+		free(all);
+	} else {
+		for (int i = 0; i < n * rounds; i++) {
+			int b = rand_r(seed) % buckets;
+			int j = op == GET_MISS || op == DEL_MISS ? MISS_CHAIN : rand_r(seed) % length;
+			keys[i] = b + j * buckets;
+		}
+	}
+	return n;
+}
+
+int compare_double(const void *a, const void *b) {
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Returns the median of some samples, sorting them.
+ */
+double median(double *samples, int n) {
+	qsort(samples, n, sizeof(double), compare_double);
+	return n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+/**
+ * Times an operation on a map with the given number of threads all
+ * running it at once: a few rounds to warm up, then ROUNDS timed ones.
+ * Reports the median time per operation of one thread, the median
+ * absolute deviation from it, and the fastest round, which unlike a mean
+ * and standard deviation a preempted or interrupted round barely moves.
+ */
+void measure(ts_hashmap_t *map, const char *table, int buckets, int length, int op, int threads) {
+	int rounds = WARMUP + ROUNDS;
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, threads);
+	pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+	worker_t *workers = malloc(sizeof(worker_t) * threads);
+	unsigned seed = 12345;
+	for (int t = 0; t < threads; t++) {
+		workers[t].map = map;
+		workers[t].op = op;
+		workers[t].keys = malloc(sizeof(int) * BATCH * rounds);
+		workers[t].n = pick_keys(workers[t].keys, op, buckets, length, t, threads, rounds, &seed);
+		workers[t].rounds = rounds;
+		workers[t].barrier = &barrier;
+		workers[t].starts = malloc(sizeof(double) * rounds);
+		workers[t].ends = malloc(sizeof(double) * rounds);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_create(&tids[t], NULL, worker, &workers[t]);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+
+	// a round lasts from the first thread starting to the last finishing
+	double samples[ROUNDS];
+	for (int r = 0; r < ROUNDS; r++) {
+		double start = workers[0].starts[WARMUP + r];
+		double end = workers[0].ends[WARMUP + r];
+		for (int t = 1; t < threads; t++) {
+			if (workers[t].starts[WARMUP + r] < start) start = workers[t].starts[WARMUP + r];
+			if (workers[t].ends[WARMUP + r] > end) end = workers[t].ends[WARMUP + r];
+		}
+		samples[r] = (end - start) * 1e9 / workers[0].n;
+	}
+	for (int t = 0; t < threads; t++) {
+		free(workers[t].keys);
+		free(workers[t].starts);
+		free(workers[t].ends);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(workers);
+	free(tids);
+
+	// median sorts the samples, so the fastest round is then the first
+	double mid = median(samples, ROUNDS);
+	double fastest = samples[0];
+	double deviations[ROUNDS];
+	for (int r = 0; r < ROUNDS; r++) {
+		deviations[r] = samples[r] > mid ? samples[r] - mid : mid - samples[r];
+	}
+	printf("%-11s %-6s %6d %8d %10.1f %8.1f %8.1f\n", opNames[op], table, length, threads, mid, median(deviations, ROUNDS), fastest);
+}
+
+/**
+ * Times every operation on a map whose chains all have the same length,
+ * first on one thread and then on several at once.
+ */
+void measure_table(const char *table, int entries, int length, int threads, int flags) {
+	int buckets = entries / (length > 0 ? length : 1);
+	ts_options_t opts = { .capacity = buckets, .flags = flags, .hash = TS_HASH_MODULO };
+	ts_hashmap_t *map = initmap_opts(&opts);
+	for (int j = 0; j < length; j++) {
+		for (int b = 0; b < buckets; b++) {
+			put(map, b + j * buckets, b);
+		}
+	}
+	for (int op = 0; op < NUM_OPS; op++) {
+		// an empty chain has nothing to hit
+		if (length == 0 && (op == GET_HIT || op == PUT_UPDATE || op == DEL_HIT)) continue;
+		measure(map, table, buckets, length, op, 1);
+		if (threads > 1) measure(map, table, buckets, length, op, threads);
+	}
+	freeMap(map);
+}
+
+/**
+ * Times each of the map's primitive operations on its own: gets that hit
+ * and miss, puts of new keys and of existing ones, deletes that hit and
+ * miss, on chains of 0, 1, 4 and 16 entries, in a table that fits in cache
+ * and one that doesn't, on one thread and on several contending for the
+ * same stripes. Takes the number of contending threads and the map's
+ * flags (in hex) as optional arguments.
+ */
+int main(int argc, char *argv[]) {
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int flags = argc > 2 ? strtol(argv[2], NULL, 16) : 0;
+	// the keys are laid out for (unsigned) key % capacity
+	flags &= ~TS_ADAPTIVE;
+	if (threads < 1 || threads >= MISS_CHAIN - 16) {
+		printf("usage: %s [threads, 1 to %d] [flags, hex]\n", argv[0], MISS_CHAIN - 17);
+		return 1;
+	}
+	int lengths[] = { 0, 1, 4, 16 };
+
+	printf("%d warmup and %d timed rounds of up to %d operations per case, flags 0x%x\n", WARMUP, ROUNDS, BATCH, flags);
+	printf("times are per operation of one thread: median, median absolute deviation and fastest round\n\n");
+	printf("%-11s %-6s %6s %8s %10s %8s %8s\n", "op", "table", "chain", "threads", "median ns", "MAD ns", "min ns");
+	for (int i = 0; i < 4; i++) {
+		measure_table("cache", CACHE_ENTRIES, lengths[i], threads, flags);
+	}
+	for (int i = 0; i < 4; i++) {
+		measure_table("dram", DRAM_ENTRIES, lengths[i], threads, flags);
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "rapl.h"
+
+// how many times more threads than CPUs each step runs
+#define STEPS 4
+const int factors[STEPS] = { 1, 2, 4, 8 };
+
+// operations taken for a latency sample: one in this many
+#define SAMPLE_EVERY 8
+
+// A way of guarding the map: a stripe lock type and any flags it goes with
+typedef struct scheme_t {
+	const char *name;
+	int lockType;
+	int flags;
+} scheme_t;
+
+const scheme_t schemes[] = {
+	{ "mutex", TS_LOCK_MUTEX, 0 },
+	{ "spin", TS_LOCK_SPIN, 0 },
+	{ "rwlock", TS_LOCK_RW, 0 },
+	{ "bravo", TS_LOCK_BRAVO, 0 },
+	{ "rcu gets", TS_LOCK_MUTEX, TS_RCU },
+};
+
+/**
+ * Runs a read-mostly workload with a hot set on each locking scheme with
+ * 1, 2, 4 and 8 times as many threads as CPUs, all confined to the same
+ * CPUs, and reports how throughput holds up against the 1x run and what
+ * happens to tail latency. Once there are more threads than CPUs a thread
+ * can be preempted while it holds a stripe lock, and everything that needs
+ * that stripe waits out its time slice: spinners burn theirs, parkers
+ * sleep, and lock-free readers don't notice. Where the RAPL counters can
+ * be read it also reports the joules each million operations cost, which
+ * is where spinning shows up even when throughput doesn't. Each thread of
+ * the rcu row holds an epoch slot, and the slot table grows to fit, so
+ * every step runs at full count however many CPUs there are. Takes the
+ * number of CPUs to confine the threads to (default: all the process may
+ * use), the key range and the total operations per run as optional
+ * arguments.
+ */
+int main(int argc, char *argv[]) {
+	int available = bench_cpus();
+	int cpus = argc > 1 ? atoi(argv[1]) : available;
+	int keys = argc > 2 ? atoi(argv[2]) : 10000;
+	long ops = argc > 3 ? atol(argv[3]) : 400000;
+	if (cpus < 1 || cpus > available || keys < 64) {
+		printf("usage: %s [cpus, 1 to %d] [keys, at least 64] [operations]\n", argv[0], available);
+		return 1;
+	}
+
+	ts_workload_t wl = { 0 };
+	wl.keyRange = keys;
+	wl.getPct = 90;
+	wl.putPct = 9;
+	wl.hotKeys = 64;
+	wl.hotPct = 50;
+	wl.cpus = cpus;
+	wl.sampleEvery = SAMPLE_EVERY;
+	printf("%d of %d CPUs, %d keys, %d%% get / %d%% put, %d%% of ops on %d hot keys, %ld ops per run\n",
+			cpus, available, keys, wl.getPct, wl.putPct, wl.hotPct, wl.hotKeys, ops);
+	printf("latencies are of one in %d operations, in microseconds\n\n", SAMPLE_EVERY);
+	rapl_t meter;
+	if (rapl_open(&meter) != 0) {
+		printf("RAPL energy counters not available here; J/Mop shows n/a\n");
+	}
+	rapl_close(&meter);
+	printf("%-9s %8s %10s %8s %8s %8s %9s %9s %8s\n", "scheme", "threads", "kops/s", "% of 1x", "p50", "p99", "p99.9", "max", "J/Mop");
+
+	int numSchemes = sizeof(schemes) / sizeof(schemes[0]);
+	for (int s = 0; s < numSchemes; s++) {
+		double base = 0;
+		for (int i = 0; i < STEPS; i++) {
+			wl.threads = cpus * factors[i];
+			wl.opsPerThread = ops / wl.threads;
+			ts_options_t opts = { .capacity = keys, .lockType = schemes[s].lockType, .flags = schemes[s].flags };
+			ts_hashmap_t *map = initmap_opts(&opts);
+			bench_prefill(map, &wl);
+			bench_result_t result;
+			bench_run(map, &wl, &result);
+			freeMap(map);
+			if (i == 0) base = result.opsPerSec;
+			printf("%-9s %8d %10.0f %8.0f %8.1f %8.1f %9.1f %9.1f", schemes[s].name, wl.threads,
+					result.opsPerSec / 1e3, 100 * result.opsPerSec / base, result.p50Ns / 1e3,
+					result.p99Ns / 1e3, result.p999Ns / 1e3, result.maxNs / 1e3);
+			if (result.joules >= 0) printf(" %8.2f\n", result.joules / (result.ops / 1e6));
+			else printf(" %8s\n", "n/a");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perfcount.h"
+
+/**
+ * Opens a counter for one event on the calling thread, stopped.
+ * @param counter the counter
+ * @param event one of the PERF_* events
+ * @return 0 on success, -1 if the event can't be counted here
+ */
+int perfcount_open(perfcount_t *counter, int event) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  if (event == PERF_L1D_MISSES) {
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  } else {
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  }
+  counter->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  return counter->fd < 0 ? -1 : 0;
+}
+
+/**
+ * Zeroes the counter and starts it.
+ */
+void perfcount_start(perfcount_t *counter) {
+  if (counter->fd >= 0) {
+    ioctl(counter->fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter->fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+/**
+ * Stops the counter.
+ * @return the events counted since perfcount_start, or -1 if unavailable
+ */
+long perfcount_stop(perfcount_t *counter) {
+  if (counter->fd < 0) {
+    return -1;
+  }
+  ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+  long long count;
+  if (read(counter->fd, &count, sizeof(count)) != sizeof(count)) {
+    return -1;
+  }
+  return count;
+}
+
+void perfcount_close(perfcount_t *counter) {
+  if (counter->fd >= 0) {
+    close(counter->fd);
+  }
+  counter->fd = -1;
+}
@@ -0,0 +1,26 @@
+/*
+ * perfcount.h
+ *
+ * Hardware event counts for the calling thread, through perf_event_open:
+ * how many cache misses a piece of code caused. Containers and most VMs
+ * don't expose the counters; there perfcount_open fails and a stopped
+ * counter reads -1, which callers print as n/a.
+ */
+
+#ifndef PERFCOUNT_H_
+#define PERFCOUNT_H_
+
+// events perfcount_open can count
+#define PERF_CACHE_MISSES 0  // last-level cache misses
+#define PERF_L1D_MISSES 1    // L1 data cache read misses
+
+typedef struct perfcount_t {
+   int fd;
+} perfcount_t;
+
+int perfcount_open(perfcount_t*, int);
+void perfcount_start(perfcount_t*);
+long perfcount_stop(perfcount_t*);
+void perfcount_close(perfcount_t*);
+
+#endif /* PERFCOUNT_H_ */
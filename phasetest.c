@@ -0,0 +1,251 @@
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ts_phase.h"
+
+// operations in each insert and delete phase, and the keys they draw
+// from: few enough keys that inserts repeat them and runs get long
+#define INSERTS 100000
+#define DELETES 60000
+#define KEY_RANGE 150000
+
+// a thread yields the CPU every so many operations, so that even with
+// fewer cores than threads their operations interleave
+#define YIELD_EVERY 64
+
+// One thread's share of a phase
+typedef struct phase_work_t {
+	ts_phase_t *table;
+	const int *keys;
+	const int *values;
+	int n;
+	int insert;
+	pthread_barrier_t *start;
+} phase_work_t;
+
+// each round's operations, as drawn
+int insertKeys[2][INSERTS];
+int insertValues[2][INSERTS];
+int deleteKeys[2][DELETES];
+
+// What the table should hold: every key ever inserted, its smallest value,
+// and whether it's in the table now
+typedef struct model_t {
+	int key;
+	int value;
+	int present;
+} model_t;
+
+void *run_phase(void *arg) {
+	phase_work_t *w = arg;
+	pthread_barrier_wait(w->start);
+	for (int i = 0; i < w->n; i++) {
+		if (w->insert) phase_insert(w->table, w->keys[i], w->values[i]);
+		else phase_delete(w->table, w->keys[i]);
+		if (i % YIELD_EVERY == 0) sched_yield();
+	}
+	return NULL;
+}
+
+/**
+ * Runs one phase of operations on a table with some number of threads,
+ * each taking every threads-th operation of the list, all starting at once.
+ */
+void phase(ts_phase_t *table, const int *keys, const int *values, int n, int insert, int threads) {
+	pthread_t tids[threads];
+	phase_work_t work[threads];
+	int *myKeys[threads];
+	int *myValues[threads];
+	pthread_barrier_t start;
+	pthread_barrier_init(&start, NULL, threads);
+	for (int t = 0; t < threads; t++) {
+		myKeys[t] = malloc(sizeof(int) * (n / threads + 1));
+		myValues[t] = malloc(sizeof(int) * (n / threads + 1));
+		int m = 0;
+		for (int i = t; i < n; i += threads) {
+			myKeys[t][m] = keys[i];
+			myValues[t][m] = values != NULL ? values[i] : 0;
+			m++;
+		}
+		work[t] = (phase_work_t) { table, myKeys[t], myValues[t], m, insert, &start };
+		pthread_create(&tids[t], NULL, run_phase, &work[t]);
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+		free(myKeys[t]);
+		free(myValues[t]);
+	}
+	pthread_barrier_destroy(&start);
+}
+
+void shuffle(int *a, int *b, int n, unsigned *seed) {
+	for (int i = n - 1; i > 0; i--) {
+		int j = rand_r(seed) % (i + 1);
+		int t = a[i]; a[i] = a[j]; a[j] = t;
+		if (b != NULL) {
+			t = b[i]; b[i] = b[j]; b[j] = t;
+		}
+	}
+}
+
+int compare_model(const void *a, const void *b) {
+	int x = ((const model_t*) a)->key;
+	int y = ((const model_t*) b)->key;
+	return (x > y) - (x < y);
+}
+
+model_t *lookup(model_t *model, int n, int key) {
+	model_t probe = { key, 0, 0 };
+	return bsearch(&probe, model, n, sizeof(model_t), compare_model);
+}
+
+/**
+ * Checks a table against the model: every key it should hold is found
+ * with its smallest value, every key it shouldn't isn't, and it holds
+ * nothing else.
+ * @return the number of keys that were wrong
+ */
+int check_model(ts_phase_t *table, model_t *model, int numModel) {
+	int wrong = 0;
+	int present = 0;
+	for (int i = 0; i < numModel; i++) {
+		int expected = model[i].present ? model[i].value : INT_MAX;
+		wrong += phase_find(table, model[i].key) != expected;
+		present += model[i].present;
+	}
+	int *keys = malloc(sizeof(int) * INSERTS * 2);
+	wrong += abs(phase_elements(table, keys, NULL) - present);
+	free(keys);
+	return wrong;
+}
+
+/**
+ * Compares two tables' contents slot by slot.
+ * @return 1 if they're laid out the same, 0 if not
+ */
+int same_layout(ts_phase_t *a, ts_phase_t *b) {
+	int *keysA = malloc(sizeof(int) * INSERTS * 2);
+	int *keysB = malloc(sizeof(int) * INSERTS * 2);
+	int *valuesA = malloc(sizeof(int) * INSERTS * 2);
+	int *valuesB = malloc(sizeof(int) * INSERTS * 2);
+	int n = phase_elements(a, keysA, valuesA);
+	int same = n == phase_elements(b, keysB, valuesB)
+			&& memcmp(keysA, keysB, n * sizeof(int)) == 0
+			&& memcmp(valuesA, valuesB, n * sizeof(int)) == 0;
+	free(keysA);
+	free(keysB);
+	free(valuesA);
+	free(valuesB);
+	return same;
+}
+
+/**
+ * Checks that the phase-concurrent table's contents and layout depend only
+ * on the operations run, not on how threads interleaved them: two rounds
+ * of an insert phase and a delete phase, run on one thread in one order
+ * and on 2 to N threads in shuffled orders, must leave every table laid
+ * out exactly the same after every phase, and agree with a model of what
+ * it should hold. Takes N (default 4) and the number of trials per thread
+ * count (default 3) as optional arguments.
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(int argc, char *argv[]) {
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+	int trials = argc > 2 ? atoi(argv[2]) : 3;
+	unsigned seed = 1;
+	for (int round = 0; round < 2; round++) {
+		for (int i = 0; i < INSERTS; i++) {
+			insertKeys[round][i] = rand_r(&seed) % KEY_RANGE - KEY_RANGE / 2;
+			insertValues[round][i] = rand_r(&seed) % 1000;
+		}
+		for (int i = 0; i < DELETES; i++) {
+			deleteKeys[round][i] = rand_r(&seed) % KEY_RANGE - KEY_RANGE / 2;
+		}
+	}
+
+	// the model: each round's inserts keep the smallest value per key
+	model_t *model = malloc(sizeof(model_t) * 2 * INSERTS);
+	int numModel = 0;
+	for (int round = 0; round < 2; round++) {
+		for (int i = 0; i < INSERTS; i++) {
+			model[numModel++] = (model_t) { insertKeys[round][i], INT_MAX, 0 };
+		}
+	}
+	qsort(model, numModel, sizeof(model_t), compare_model);
+	int distinct = 0;
+	for (int i = 0; i < numModel; i++) {
+		if (distinct == 0 || model[distinct - 1].key != model[i].key) model[distinct++] = model[i];
+	}
+	numModel = distinct;
+
+	// the reference: one thread, operations in the order they were drawn
+	ts_phase_t *reference[4];
+	ts_phase_t *table = phase_init(2 * INSERTS);
+	int failed = 0;
+	for (int step = 0; step < 4; step++) {
+		int round = step / 2;
+		if (step % 2 == 0) {
+			phase(table, insertKeys[round], insertValues[round], INSERTS, 1, 1);
+			for (int i = 0; i < INSERTS; i++) {
+				model_t *m = lookup(model, numModel, insertKeys[round][i]);
+				if (!m->present || insertValues[round][i] < m->value) m->value = insertValues[round][i];
+				m->present = 1;
+			}
+		} else {
+			phase(table, deleteKeys[round], NULL, DELETES, 0, 1);
+			for (int i = 0; i < DELETES; i++) {
+				model_t *m = lookup(model, numModel, deleteKeys[round][i]);
+				if (m != NULL) m->present = 0;
+			}
+		}
+		int wrong = check_model(table, model, numModel);
+		printf("1 thread, %s phase %d: %s", step % 2 ? "delete" : "insert", round + 1, wrong ? "FAILED" : "ok");
+		if (wrong) printf(" (%d keys wrong)", wrong);
+		printf("\n");
+		failed |= wrong != 0;
+		// snapshot the layout for the others to match
+		reference[step] = phase_init(2 * INSERTS);
+		memcpy(reference[step]->slots, table->slots, table->numSlots * sizeof(uint64_t));
+	}
+	phase_free(table);
+
+	int *keys = malloc(sizeof(int) * INSERTS);
+	int *values = malloc(sizeof(int) * INSERTS);
+	for (int threads = 2; threads <= maxThreads; threads++) {
+		int differed = 0;
+		for (int trial = 0; trial < trials; trial++) {
+			table = phase_init(2 * INSERTS);
+			for (int step = 0; step < 4; step++) {
+				int round = step / 2;
+				if (step % 2 == 0) {
+					memcpy(keys, insertKeys[round], sizeof(int) * INSERTS);
+					memcpy(values, insertValues[round], sizeof(int) * INSERTS);
+					shuffle(keys, values, INSERTS, &seed);
+					phase(table, keys, values, INSERTS, 1, threads);
+				} else {
+					memcpy(keys, deleteKeys[round], sizeof(int) * DELETES);
+					shuffle(keys, NULL, DELETES, &seed);
+					phase(table, keys, NULL, DELETES, 0, threads);
+				}
+				if (!same_layout(table, reference[step])) {
+					printf("%d threads, trial %d, %s phase %d: FAILED (layout differs from 1 thread)\n",
+							threads, trial + 1, step % 2 ? "delete" : "insert", round + 1);
+					differed = 1;
+				}
+			}
+			phase_free(table);
+		}
+		printf("%d threads, %d shuffled trials: %s\n", threads, trials, differed ? "FAILED" : "ok");
+		failed |= differed;
+	}
+	free(keys);
+	free(values);
+	for (int step = 0; step < 4; step++) {
+		phase_free(reference[step]);
+	}
+	free(model);
+	return failed;
+}
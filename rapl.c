@@ -0,0 +1,94 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "rapl.h"
+
+/**
+ * Reads a counter file from the start.
+ * @return its value, or -1 if it can't be read
+ */
+static long long read_counter(int fd) {
+  char buf[32];
+  ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) {
+    return -1;
+  }
+  buf[n] = '\0';
+  return atoll(buf);
+}
+
+/**
+ * Opens a meter over every CPU package's RAPL zone. Only the top-level
+ * zones (intel-rapl:N) are read; their subzones (cores, uncore, DRAM) are
+ * parts of them and would be counted twice.
+ * @param meter the meter
+ * @return 0 on success, -1 if there are no zones or they can't be read
+ */
+int rapl_open(rapl_t *meter) {
+  meter->numZones = 0;
+  for (int zone = 0; zone < RAPL_MAX_ZONES; zone++) {
+    char path[96];
+    snprintf(path, sizeof(path), RAPL_ROOT "/intel-rapl:%d/energy_uj", zone);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      continue;
+    }
+    if (read_counter(fd) < 0) {
+      close(fd);
+      continue;
+    }
+    // without a range we can't tell a wrap from a reset, so assume the
+    // 32-bit counter of older kernels
+    long long range = 1LL << 32;
+    snprintf(path, sizeof(path), RAPL_ROOT "/intel-rapl:%d/max_energy_range_uj", zone);
+    int rangeFd = open(path, O_RDONLY);
+    if (rangeFd >= 0) {
+      long long r = read_counter(rangeFd);
+      if (r > 0) {
+        range = r;
+      }
+      close(rangeFd);
+    }
+    meter->fds[meter->numZones] = fd;
+    meter->range[meter->numZones] = range;
+    meter->numZones++;
+  }
+  return meter->numZones > 0 ? 0 : -1;
+}
+
+/**
+ * Notes where every zone's counter is now.
+ */
+void rapl_start(rapl_t *meter) {
+  for (int i = 0; i < meter->numZones; i++) {
+    meter->start[i] = read_counter(meter->fds[i]);
+  }
+}
+
+/**
+ * Reads the energy used since rapl_start, allowing for each counter
+ * having wrapped around once.
+ * @return joules used by all packages together, or -1 if unavailable
+ */
+double rapl_stop(rapl_t *meter) {
+  if (meter->numZones == 0) {
+    return -1;
+  }
+  long long total = 0;
+  for (int i = 0; i < meter->numZones; i++) {
+    long long now = read_counter(meter->fds[i]);
+    if (now < 0 || meter->start[i] < 0) {
+      return -1;
+    }
+    total += now >= meter->start[i] ? now - meter->start[i] : now + meter->range[i] - meter->start[i];
+  }
+  return total / 1e6;
+}
+
+void rapl_close(rapl_t *meter) {
+  for (int i = 0; i < meter->numZones; i++) {
+    close(meter->fds[i]);
+  }
+  meter->numZones = 0;
+}
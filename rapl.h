@@ -0,0 +1,33 @@
+/*
+ * rapl.h
+ *
+ * Energy used by the CPU packages while a piece of code ran, from the
+ * RAPL counters Linux exposes under /sys/class/powercap. The counters are
+ * per package, not per process, so anything else running at the time is
+ * counted too. Containers, VMs and non-RAPL CPUs usually don't expose
+ * them, and newer kernels only let root read them; there rapl_open fails
+ * and a stopped meter reads -1, which callers print as n/a.
+ */
+
+#ifndef RAPL_H_
+#define RAPL_H_
+
+// where the powercap zones live, and how many packages are looked for
+#define RAPL_ROOT "/sys/class/powercap"
+#define RAPL_MAX_ZONES 16
+
+// A meter: the package zones' energy counter files, what each read when
+// the meter was started, and where each wraps around (all microjoules)
+typedef struct rapl_t {
+   int numZones;
+   int fds[RAPL_MAX_ZONES];
+   long long start[RAPL_MAX_ZONES];
+   long long range[RAPL_MAX_ZONES];
+} rapl_t;
+
+int rapl_open(rapl_t*);
+void rapl_start(rapl_t*);
+double rapl_stop(rapl_t*);
+void rapl_close(rapl_t*);
+
+#endif /* RAPL_H_ */
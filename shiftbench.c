@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+// timed slices each phase is reported in, so the first slice after a
+// change shows what adapting to it costs and the last what it settles to
+#define SLICES 4
+
+// operations taken for a latency sample: one in this many
+#define SAMPLE_EVERY 16
+
+// A phase of the schedule: its operation mix, where its hot set starts (as
+// a fraction of the key range) and how much of the traffic goes there, and
+// how long it lasts relative to the others
+typedef struct shift_phase_t {
+	const char *name;
+	int getPct;
+	int putPct;
+	double hotAt;
+	int hotPct;
+	double length;
+} shift_phase_t;
+
+// the hot set moves twice and comes back, reads give way to writes for a
+// while, and a short burst of deletes hits keys all over
+const shift_phase_t schedule[] = {
+	{ "steady, hot set A", 90, 9, 0.0, 80, 1.0 },
+	{ "hot set moves to B", 90, 9, 0.33, 80, 1.0 },
+	{ "writes swing up", 40, 55, 0.33, 80, 1.0 },
+	{ "delete burst", 20, 0, 0.0, 0, 0.25 },
+	{ "hot set moves to C", 90, 9, 0.66, 80, 1.0 },
+	{ "back to hot set A", 90, 9, 0.0, 80, 1.0 },
+};
+
+// A map to put through the schedule
+typedef struct shift_map_t {
+	const char *name;
+	int flags;
+} shift_map_t;
+
+const shift_map_t maps[] = {
+	{ "fixed", 0 },
+	{ "adaptive", TS_ADAPTIVE },
+	{ "cache", TS_CACHE },
+};
+
+/**
+ * Puts one map through the whole schedule, without a break or a fresh map
+ * between phases, and prints each slice of each phase.
+ */
+void run_schedule(const shift_map_t *m, int threads, int keys, double seconds) {
+	ts_options_t opts = { .capacity = keys / 8, .flags = m->flags, .maxEntries = keys / 4 };
+	ts_hashmap_t *map = initmap_opts(&opts);
+	ts_workload_t wl = { 0 };
+	wl.threads = threads;
+	wl.keyRange = keys;
+	wl.hotKeys = keys / 100 > 0 ? keys / 100 : 1;
+	wl.sampleEvery = SAMPLE_EVERY;
+	bench_prefill(map, &wl);
+
+	printf("%s map (flags 0x%x)\n", m->name, m->flags);
+	int numPhases = sizeof(schedule) / sizeof(schedule[0]);
+	for (int p = 0; p < numPhases; p++) {
+		const shift_phase_t *phase = &schedule[p];
+		wl.getPct = phase->getPct;
+		wl.putPct = phase->putPct;
+		wl.hotBase = (int) (phase->hotAt * keys);
+		wl.hotPct = phase->hotPct;
+		wl.seconds = seconds * phase->length / SLICES;
+		for (int s = 0; s < SLICES; s++) {
+			bench_result_t result;
+			bench_run(map, &wl, &result);
+			printf("%-20s %5d %10.0f %6.1f %8.1f %8.1f %9.1f %8d %9d\n", s == 0 ? phase->name : "", s + 1,
+					result.opsPerSec / 1e3, result.gets ? 100.0 * result.hits / result.gets : 0,
+					result.p50Ns / 1e3, result.p99Ns / 1e3, result.p999Ns / 1e3, map->size, map->capacity);
+		}
+	}
+	printf("\n");
+	freeMap(map);
+}
+
+/**
+ * Runs a workload whose key distribution changes over time against a
+ * fixed map, a TS_ADAPTIVE one and a TS_CACHE one holding a quarter of the
+ * keys, and reports each phase a slice at a time: throughput, how many
+ * gets hit, latency, and the map's size and capacity. Takes the number of
+ * threads, the key range and the seconds a phase lasts as optional
+ * arguments.
+ */
+int main(int argc, char *argv[]) {
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int keys = argc > 2 ? atoi(argv[2]) : 100000;
+	double seconds = argc > 3 ? atof(argv[3]) : 1.0;
+	if (threads < 1 || keys < 8 || seconds <= 0) {
+		printf("usage: %s [threads] [keys, at least 8] [seconds per phase]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d threads, %d keys, %d hot, %.2f s a phase in %d slices\n", threads, keys, keys / 100, seconds, SLICES);
+	printf("latencies are of one in %d operations, in microseconds\n\n", SAMPLE_EVERY);
+	printf("%-20s %5s %10s %6s %8s %8s %9s %8s %9s\n", "phase", "slice", "kops/s", "hit %", "p50", "p99", "p99.9", "size", "capacity");
+	int numMaps = sizeof(maps) / sizeof(maps[0]);
+	for (int i = 0; i < numMaps; i++) {
+		run_schedule(&maps[i], threads, keys, seconds);
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ts_simd.h"
+
+// random batches each kernel is checked on
+#define TRIALS 20000
+
+// longest batch; long enough for several vectors and every tail length
+#define MAX_N 300
+
+// keys that tend to break the unsigned modulo and the vector tails
+const int edges[] = { 0, 1, -1, INT_MAX, INT_MIN, INT_MAX - 1, INT_MIN + 1 };
+#define NUM_EDGES (int) (sizeof(edges) / sizeof(edges[0]))
+
+/**
+ * A random 32-bit int, negative ones included; now and then an edge case.
+ */
+int random_key(unsigned *seed) {
+	if (rand_r(seed) % 16 == 0) {
+		return edges[rand_r(seed) % NUM_EDGES];
+	}
+	return (int) (((unsigned) rand_r(seed) << 16) ^ (unsigned) rand_r(seed));
+}
+
+/**
+ * Runs one kernel and the scalar reference on the same random batches.
+ * @return the number of batches on which they disagreed
+ */
+int check(int which, const ts_kernels_t *k, unsigned *seed) {
+	const ts_kernels_t *ref = simd_kernels(SIMD_SCALAR);
+	int keys[MAX_N];
+	int expected[MAX_N];
+	int got[MAX_N];
+	int failures = 0;
+	for (int t = 0; t < TRIALS; t++) {
+		int n = rand_r(seed) % (MAX_N + 1);
+		for (int i = 0; i < n; i++) {
+			keys[i] = random_key(seed);
+		}
+		// a small capacity half the time, any positive int the other half
+		int capacity = rand_r(seed) % 2 ? 1 + rand_r(seed) % 1000 : 1 + (random_key(seed) & INT_MAX) % INT_MAX;
+		unsigned mask = (1u << (rand_r(seed) % 32)) - 1;
+		switch (which) {
+			case 0:
+				ref->hash_batch(keys, expected, n, capacity);
+				if (k != NULL) k->hash_batch(keys, got, n, capacity);
+				else hash_batch(keys, got, n, capacity);
+				break;
+			case 1:
+				ref->mult_batch(keys, expected, n, mask);
+				if (k != NULL) k->mult_batch(keys, got, n, mask);
+				else mult_batch(keys, got, n, mask);
+				break;
+			default:
+				ref->murmur_batch(keys, expected, n, mask);
+				if (k != NULL) k->murmur_batch(keys, got, n, mask);
+				else murmur_batch(keys, got, n, mask);
+				break;
+		}
+		for (int i = 0; i < n; i++) {
+			if (got[i] != expected[i]) {
+				if (failures == 0) {
+					printf("  key %d (n = %d, capacity %d, mask 0x%x): got %d, expected %d\n",
+							keys[i], n, capacity, mask, got[i], expected[i]);
+				}
+				failures++;
+				break;
+			}
+		}
+	}
+	return failures;
+}
+
+/**
+ * Checks every kernel at every instruction set level this CPU supports,
+ * and the load-time dispatched entry points, against the scalar reference
+ * on random batches of every length up to MAX_N.
+ * @return 0 if they all agree, 1 otherwise
+ */
+int main(int argc, char *argv[]) {
+	unsigned seed = argc > 1 ? atoi(argv[1]) : 1;
+	const char *names[] = { "hash_batch", "mult_batch", "murmur_batch" };
+	int failed = 0;
+	printf("widest level on this CPU: %s\n", simd_kernels(simd_level())->name);
+	for (int which = 0; which < 3; which++) {
+		for (int level = SIMD_SSE42; level <= SIMD_LEVELS; level++) {
+			// one past the last level is the dispatched entry point
+			const ts_kernels_t *k = level < SIMD_LEVELS ? simd_kernels(level) : NULL;
+			if (level < SIMD_LEVELS && k == NULL) {
+				continue;
+			}
+			int failures = check(which, k, &seed);
+			printf("%-13s %-11s %s", names[which], k != NULL ? k->name : "dispatched", failures ? "FAILED" : "ok");
+			if (failures) printf(" (%d of %d batches)", failures, TRIALS);
+			printf("\n");
+			failed |= failures != 0;
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,93 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "ts_hashmap.h"
+#include "ts_stream.h"
+
+#define THREADS 4
+
+// rounds in which every thread's add has to wait for the stripe lock,
+// plenty to make the key hot enough to split if the map would split it
+#define CONTENDED_ROUNDS 32
+
+// adds each thread makes once the contended rounds are over
+#define FREE_ADDS 20000
+
+// the key every thread adds to
+#define KEY 42
+
+ts_hashmap_t *map;
+pthread_barrier_t barrier;
+
+/**
+ * Adds 1 to the key once per contended round, while the main thread holds
+ * its stripe lock, and then as fast as it can.
+ */
+void *adder(void *arg) {
+	for (int r = 0; r < CONTENDED_ROUNDS; r++) {
+		pthread_barrier_wait(&barrier);
+		fetch_add(map, KEY, 1);
+		pthread_barrier_wait(&barrier);
+	}
+	for (int i = 0; i < FREE_ADDS; i++) {
+		fetch_add(map, KEY, 1);
+	}
+	return NULL;
+}
+
+/**
+ * Checks that fetch_adds on a TS_STREAM map all reach the change stream,
+ * even for a key whose adds keep waiting on its stripe lock (which on
+ * other maps is split into per-core sub-values that bypass the lock): one
+ * put record per add, in order, each with the running total.
+ * @return 0 if the stream has every add, 1 otherwise
+ */
+int main(int argc, char *argv[]) {
+	long total = (long) THREADS * (CONTENDED_ROUNDS + FREE_ADDS);
+	// one stripe, so the key's ring and lock are stripe 0's, and a ring big
+	// enough that nothing is dropped
+	ts_options_t opts = { .capacity = 64, .numStripes = 1, .flags = TS_STREAM, .streamCapacity = total };
+	map = initmap_opts(&opts);
+	pthread_barrier_init(&barrier, NULL, THREADS + 1);
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, adder, NULL);
+	}
+	ts_lock_t *lock = &map->stripes[0].lock;
+	for (int r = 0; r < CONTENDED_ROUNDS; r++) {
+		lock_write(lock);
+		pthread_barrier_wait(&barrier);
+		// give every adder time to find the lock taken and queue up on it
+		usleep(2000);
+		unlock(lock);
+		pthread_barrier_wait(&barrier);
+	}
+	for (int i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	ts_change_t *records = malloc(total * sizeof(ts_change_t));
+	long n = 0;
+	int got;
+	while ((got = stream_read(map, records + n, total - n)) > 0) {
+		n += got;
+	}
+	int failed = 0;
+	for (long i = 0; i < n && !failed; i++) {
+		if (records[i].key != KEY || records[i].op != TS_CHANGE_PUT || records[i].value != i + 1) {
+			printf("record %ld: key %d, op %d, value %d; expected a put of %ld\n", i, records[i].key, records[i].op, records[i].value, i + 1);
+			failed = 1;
+		}
+	}
+	int value = get(map, KEY);
+	printf("%ld adds, %ld records read, %lu lost, final value %d\n", total, n, stream_lost(map), value);
+	if (n != total || value != total || stream_lost(map) != 0) {
+		failed = 1;
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	free(records);
+	pthread_barrier_destroy(&barrier);
+	freeMap(map);
+	return failed;
+}
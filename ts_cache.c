@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include "ts_cache.h"
+
+// keeps every other bit of each nibble once a word's counters are halved
+#define HALVE_MASK 0x7777777777777777UL
+
+// one multiplier per sketch row
+static const unsigned long seeds[CACHE_DEPTH] = {
+  0x97cb3127a6d5c1e3UL, 0xb492b66fbe98f273UL, 0x9ae16a3b2f90404fUL, 0xcbf29ce484222325UL
+};
+
+// The calling thread's accesses not yet applied to the cache it used last
+typedef struct cache_reads_t {
+  ts_cache_t *cache;
+  int count;
+  int keys[CACHE_READ_BATCH];
+} cache_reads_t;
+
+static __thread cache_reads_t reads;
+
+/**
+ * Scrambles a key (the murmur3 finalizer) so neighbouring keys spread out.
+ */
+static unsigned mix(int key) {
+  unsigned h = (unsigned) key;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * Where a key's counter in one row of the sketch is: the word, and the
+ * shift of its nibble in there.
+ */
+static unsigned long *counter_of(ts_cache_t *cache, int key, int row, int *shift) {
+  unsigned long h = ((unsigned long) mix(key) + seeds[row]) * seeds[row];
+  h ^= h >> 32;
+  *shift = (int) (h & 15) * 4;
+  return &cache->sketch[(h >> 4) & cache->sketchMask];
+}
+
+/**
+ * How often a key has been used lately: the smallest of its counters.
+ */
+static int frequency(ts_cache_t *cache, int key) {
+  int freq = 15;
+  for (int row = 0; row < CACHE_DEPTH; row++) {
+    int shift;
+    int count = (int) ((*counter_of(cache, key, row, &shift) >> shift) & 15);
+    if (count < freq) {
+      freq = count;
+    }
+  }
+  return freq;
+}
+
+/**
+ * Counts a use of a key in the sketch, halving every counter once enough
+ * uses have been counted since the last time.
+ */
+static void count_use(ts_cache_t *cache, int key) {
+  int added = 0;
+  for (int row = 0; row < CACHE_DEPTH; row++) {
+    int shift;
+    unsigned long *word = counter_of(cache, key, row, &shift);
+    if (((*word >> shift) & 15) < 15) {
+      *word += 1UL << shift;
+      added = 1;
+    }
+  }
+  if (added && ++cache->samples >= cache->sampleLimit) {
+    for (unsigned i = 0; i <= cache->sketchMask; i++) {
+      cache->sketch[i] = (cache->sketch[i] >> 1) & HALVE_MASK;
+    }
+    cache->samples /= 2;
+  }
+}
+
+/**
+ * Finds the slot holding a key's node, or the empty slot it would go in.
+ */
+static unsigned find_slot(ts_cache_t *cache, int key) {
+  unsigned i = mix(key) & cache->slotsMask;
+  while (cache->slots[i] != 0 && cache->nodes[cache->slots[i]].key != key) {
+    i = (i + 1) & cache->slotsMask;
+  }
+  return i;
+}
+
+/**
+ * Empties a slot, moving later nodes of the same probe run back into the
+ * gap so that lookups don't stop short.
+ */
+static void clear_slot(ts_cache_t *cache, unsigned i) {
+  cache->slots[i] = 0;
+  unsigned j = i;
+  while (1) {
+    j = (j + 1) & cache->slotsMask;
+    if (cache->slots[j] == 0) {
+      return;
+    }
+    unsigned home = mix(cache->nodes[cache->slots[j]].key) & cache->slotsMask;
+    // the node at j can fill the gap if the gap lies on its probe path
+    if (((j - home) & cache->slotsMask) >= ((j - i) & cache->slotsMask)) {
+      cache->slots[i] = cache->slots[j];
+      cache->slots[j] = 0;
+      i = j;
+    }
+  }
+}
+
+/**
+ * Takes a node out of its segment's list.
+ */
+static void unlink_node(ts_cache_t *cache, int n) {
+  ts_cnode_t *node = &cache->nodes[n];
+  cache->nodes[node->prev].next = node->next;
+  cache->nodes[node->next].prev = node->prev;
+  cache->count[node->segment]--;
+}
+
+/**
+ * Puts a node at the most recently used end of a segment's list.
+ */
+static void push_node(ts_cache_t *cache, int n, int segment) {
+  ts_cnode_t *node = &cache->nodes[n];
+  ts_cnode_t *sentinel = &cache->nodes[segment];
+  node->segment = segment;
+  node->prev = segment;
+  node->next = sentinel->next;
+  cache->nodes[sentinel->next].prev = n;
+  sentinel->next = n;
+  cache->count[segment]++;
+}
+
+/**
+ * Moves a tracked key up its list when it's used again; a key on
+ * probation is promoted to protected, which pushes the least recently
+ * used protected keys back to probation if there are too many.
+ */
+static void on_access(ts_cache_t *cache, int n) {
+  int segment = cache->nodes[n].segment;
+  unlink_node(cache, n);
+  if (segment != CACHE_PROBATION) {
+    push_node(cache, n, segment);
+    return;
+  }
+  push_node(cache, n, CACHE_PROTECTED);
+  while (cache->count[CACHE_PROTECTED] > cache->protectedMax) {
+    int demoted = cache->nodes[CACHE_PROTECTED].prev;
+    unlink_node(cache, demoted);
+    push_node(cache, demoted, CACHE_PROBATION);
+  }
+}
+
+/**
+ * Applies one access to the policy. Caller holds the policy's lock.
+ */
+static void record(ts_cache_t *cache, int key) {
+  count_use(cache, key);
+  int n = cache->slots[find_slot(cache, key)];
+  if (n != 0) {
+    on_access(cache, n);
+  }
+}
+
+/**
+ * Stops tracking a key and queues it to be deleted from the map.
+ */
+static void evict(ts_cache_t *cache, int n) {
+  int key = cache->nodes[n].key;
+  unlink_node(cache, n);
+  clear_slot(cache, find_slot(cache, key));
+  cache->nodes[n].next = cache->freeNode;
+  cache->freeNode = n;
+  if (cache->numVictims == cache->maxVictims) {
+    cache->maxVictims *= 2;
+    cache->victims = (int*) realloc(cache->victims, cache->maxVictims * sizeof(int));
+  }
+  cache->victims[cache->numVictims++] = key;
+  cache->evicted++;
+}
+
+/**
+ * Creates the policy for a cache of the given size.
+ * @param maxEntries the most keys the cache holds
+ * @return a pointer to the new policy
+ */
+ts_cache_t *cache_init(int maxEntries) {
+  ts_cache_t *cache = (ts_cache_t*) calloc(1, sizeof(ts_cache_t));
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->maxEntries = maxEntries > 0 ? maxEntries : 1;
+  cache->windowMax = cache->maxEntries * CACHE_WINDOW_PCT / 100;
+  if (cache->windowMax < 1) {
+    cache->windowMax = 1;
+  }
+  cache->protectedMax = (long) (cache->maxEntries - cache->windowMax) * CACHE_PROTECTED_PCT / 100;
+  // sixteen counters per word, a word per key
+  unsigned words = 1;
+  while (words < (unsigned) cache->maxEntries) {
+    words <<= 1;
+  }
+  cache->sketch = (unsigned long*) calloc(words, sizeof(unsigned long));
+  cache->sketchMask = words - 1;
+  cache->sampleLimit = (long) CACHE_AGE_FACTOR * cache->maxEntries;
+  // an insert tracks its key before it evicts, so there's one spare node,
+  // after the three sentinels
+  int numNodes = 3 + cache->maxEntries + 1;
+  cache->nodes = (ts_cnode_t*) malloc(numNodes * sizeof(ts_cnode_t));
+  for (int s = 0; s < 3; s++) {
+    cache->nodes[s].prev = s;
+    cache->nodes[s].next = s;
+    cache->nodes[s].segment = s;
+  }
+  cache->freeNode = 0;
+  for (int n = numNodes - 1; n >= 3; n--) {
+    cache->nodes[n].next = cache->freeNode;
+    cache->freeNode = n;
+  }
+  // at most half full, so probe runs stay short
+  unsigned slots = 1;
+  while (slots < 2 * (unsigned) numNodes) {
+    slots <<= 1;
+  }
+  cache->slots = (int*) calloc(slots, sizeof(int));
+  cache->slotsMask = slots - 1;
+  cache->maxVictims = 16;
+  cache->victims = (int*) malloc(cache->maxVictims * sizeof(int));
+  return cache;
+}
+
+/**
+ * Notes that a key was looked up or written, whether or not the cache has
+ * it: a key that keeps being asked for earns its way in. Buffered per
+ * thread; a batch that finds the policy busy is dropped rather than waited
+ * for, since an access or two more or less doesn't change much.
+ * @param cache the policy
+ * @param key the key
+ */
+void cache_touch(ts_cache_t *cache, int key) {
+  if (reads.cache != cache) {
+    // the last cache may be gone by now; drop what was buffered for it
+    reads.cache = cache;
+    reads.count = 0;
+  }
+  reads.keys[reads.count++] = key;
+  if (reads.count < CACHE_READ_BATCH) {
+    return;
+  }
+  if (pthread_mutex_trylock(&cache->lock) == 0) {
+    for (int i = 0; i < reads.count; i++) {
+      record(cache, reads.keys[i]);
+    }
+    pthread_mutex_unlock(&cache->lock);
+  }
+  reads.count = 0;
+}
+
+/**
+ * Starts tracking a key that has just been added to the map, in the
+ * window. If the cache is then over its size, the key leaving the window
+ * and the least recently used key on probation compete on frequency, and
+ * the loser is queued for eviction (see cache_victim). Called under the
+ * key's stripe lock.
+ * @param cache the policy
+ * @param key the key
+ */
+void cache_insert(ts_cache_t *cache, int key) {
+  pthread_mutex_lock(&cache->lock);
+  unsigned slot = find_slot(cache, key);
+  if (cache->slots[slot] != 0) {
+    on_access(cache, cache->slots[slot]);
+    pthread_mutex_unlock(&cache->lock);
+    return;
+  }
+  int n = cache->freeNode;
+  cache->freeNode = cache->nodes[n].next;
+  cache->nodes[n].key = key;
+  cache->slots[slot] = n;
+  push_node(cache, n, CACHE_WINDOW);
+  int candidate = 0;
+  if (cache->count[CACHE_WINDOW] > cache->windowMax) {
+    candidate = cache->nodes[CACHE_WINDOW].prev;
+    unlink_node(cache, candidate);
+    push_node(cache, candidate, CACHE_PROBATION);
+  }
+  if (cache->count[CACHE_WINDOW] + cache->count[CACHE_PROBATION] + cache->count[CACHE_PROTECTED] > cache->maxEntries) {
+    // probation goes first; the others only run dry on a tiny cache
+    int victim = cache->nodes[CACHE_PROBATION].prev;
+    if (victim == CACHE_PROBATION) {
+      victim = cache->nodes[CACHE_PROTECTED].prev;
+    }
+    if (victim == CACHE_PROTECTED) {
+      victim = cache->nodes[CACHE_WINDOW].prev;
+    }
+    if (candidate != 0 && candidate != victim) {
+      // ties go to the key that's already in, so a scan can't flush it
+      if (frequency(cache, cache->nodes[candidate].key) > frequency(cache, cache->nodes[victim].key)) {
+        cache->admitted++;
+      } else {
+        cache->rejected++;
+        victim = candidate;
+      }
+    }
+    evict(cache, victim);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Stops tracking a key that has been deleted from the map. Called under
+ * the key's stripe lock.
+ * @param cache the policy
+ * @param key the key
+ */
+void cache_remove(ts_cache_t *cache, int key) {
+  pthread_mutex_lock(&cache->lock);
+  unsigned slot = find_slot(cache, key);
+  int n = cache->slots[slot];
+  if (n != 0) {
+    unlink_node(cache, n);
+    clear_slot(cache, slot);
+    cache->nodes[n].next = cache->freeNode;
+    cache->freeNode = n;
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Takes the next key queued for eviction. The policy has already stopped
+ * tracking it; the caller deletes it from the map.
+ * @param cache the policy
+ * @param key where to store the key
+ * @return 1 if there was one, 0 if the queue is empty
+ */
+int cache_victim(ts_cache_t *cache, int *key) {
+  int found = 0;
+  pthread_mutex_lock(&cache->lock);
+  if (cache->numVictims > 0) {
+    *key = cache->victims[--cache->numVictims];
+    found = 1;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return found;
+}
+
+/**
+ * Frees a policy.
+ */
+void cache_free(ts_cache_t *cache) {
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->sketch);
+  free(cache->nodes);
+  free(cache->slots);
+  free(cache->victims);
+  free(cache);
+}
@@ -0,0 +1,88 @@
+/*
+ * ts_cache.h
+ *
+ * The eviction policy of a TS_CACHE map, W-TinyLFU. A new key goes into a
+ * small LRU window. A key pushed out of the window only gets into the main
+ * space (a segmented LRU of probation and protected keys) if a frequency
+ * sketch says it has been used more often than the key it would push out
+ * there; otherwise it's the one evicted. A scan of one-off keys so washes
+ * through the window instead of flushing the keys that keep being used.
+ * The sketch is a count-min sketch of 4-bit counters, halved every so
+ * often so that it follows what's popular now.
+ *
+ * Keys join and leave the policy under their stripe lock, as they join
+ * and leave the map, with the policy's own lock inside it. Victims are
+ * queued and deleted from the map later, by the put that picked them,
+ * once it has let go of its stripe lock. Gets only record an access, in a
+ * per-thread buffer that's applied a batch at a time, and dropped when
+ * the policy is busy.
+ */
+
+#ifndef TS_CACHE_H_
+#define TS_CACHE_H_
+
+#include <pthread.h>
+
+// counters per key in the sketch
+#define CACHE_DEPTH 4
+
+// sketch samples per cached key before the counters are halved
+#define CACHE_AGE_FACTOR 10
+
+// percent of the cache that's the window, and percent of the rest that
+// keys used again while on probation can take up
+#define CACHE_WINDOW_PCT 1
+#define CACHE_PROTECTED_PCT 80
+
+// accesses a thread buffers before applying them to the policy
+#define CACHE_READ_BATCH 32
+
+// segments; each is also the index of its list's sentinel node
+#define CACHE_WINDOW 0
+#define CACHE_PROBATION 1
+#define CACHE_PROTECTED 2
+
+// A key the policy tracks: its neighbours in its segment's LRU list
+// (most recently used first) and the segment
+typedef struct ts_cnode_t {
+   int key;
+   int prev;
+   int next;
+   int segment;
+} ts_cnode_t;
+
+// A cache policy: the sketch and how many samples it has taken since it
+// was last halved, the tracked keys (nodes, found by key through the
+// open-addressed slots table; 0 is empty), the size of each segment and
+// its limit, the keys picked for eviction that haven't been deleted yet,
+// and what admission has decided so far
+typedef struct ts_cache_t {
+   pthread_mutex_t lock;
+   unsigned long *sketch;
+   unsigned sketchMask;
+   long samples;
+   long sampleLimit;
+   ts_cnode_t *nodes;
+   int freeNode;
+   int *slots;
+   unsigned slotsMask;
+   int maxEntries;
+   int windowMax;
+   int protectedMax;
+   int count[3];
+   int *victims;
+   int numVictims;
+   int maxVictims;
+   long admitted;
+   long rejected;
+   long evicted;
+} ts_cache_t;
+
+ts_cache_t *cache_init(int);
+void cache_touch(ts_cache_t*, int);
+void cache_insert(ts_cache_t*, int);
+void cache_remove(ts_cache_t*, int);
+int cache_victim(ts_cache_t*, int*);
+void cache_free(ts_cache_t*);
+
+#endif /* TS_CACHE_H_ */
@@ -0,0 +1,327 @@
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "ts_epoch.h"
+
+// number of retired nodes a thread collects before trying to advance the epoch
+#define EPOCH_COLLECT_THRESHOLD 64
+
+// A retired node waiting for its grace period
+typedef struct retired_t {
+  void *ptr;
+  void (*release)(void*);
+  unsigned long epoch;
+} retired_t;
+
+// Per-thread state. The state word holds the epoch the thread observed
+// when it entered, shifted left by one, with the low bit set while the
+// thread is inside a critical section. The limbo list is a FIFO of retired
+// nodes, oldest first, guarded by a tiny spinlock so epoch_barrier() can
+// drain other threads' lists.
+typedef struct epoch_slot_t {
+  unsigned long state;
+  int used;
+  int depth;
+  int limboLock;
+  retired_t *limbo;
+  int limboHead;
+  int limboTail;
+  int limboCap;
+} __attribute__((aligned(64))) epoch_slot_t;
+
+// A block of slots. Blocks are chained on as threads need them and never
+// freed, so a slot stays where it is and scans walk the chain unlocked.
+typedef struct epoch_block_t {
+  epoch_slot_t slots[EPOCH_BLOCK_SLOTS];
+  struct epoch_block_t *next;
+} epoch_block_t;
+
+static unsigned long globalEpoch = 0;
+static epoch_block_t firstBlock;
+static __thread epoch_slot_t *mySlot = NULL;
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+// set once light read sections are on: readers skip their fence, and
+// whoever advances the epoch has the kernel fence every thread instead
+static int lightReads = 0;
+static pthread_once_t lightOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Hands a slot back when its thread exits. Anything still in limbo stays
+ * with the slot and is released by whichever thread claims it next.
+ */
+static void release_slot(void *arg) {
+  epoch_slot_t *slot = (epoch_slot_t*) arg;
+  __atomic_store_n(&slot->state, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->used, 0, __ATOMIC_RELEASE);
+}
+
+static void make_slot_key() {
+  pthread_key_create(&slotKey, release_slot);
+}
+
+/**
+ * Finds (or claims) the calling thread's slot.
+ */
+static epoch_slot_t *my_slot() {
+  if (mySlot != NULL) {
+    return mySlot;
+  }
+  pthread_once(&slotKeyOnce, make_slot_key);
+  // claim the first free slot, adding a block if every slot is taken
+  epoch_block_t *block = &firstBlock;
+  while (1) {
+    for (int i = 0; i < EPOCH_BLOCK_SLOTS; i++) {
+      int expected = 0;
+      if (__atomic_compare_exchange_n(&block->slots[i].used, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        mySlot = &block->slots[i];
+        pthread_setspecific(slotKey, mySlot);
+        return mySlot;
+      }
+    }
+    epoch_block_t *next = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+      epoch_block_t *added = (epoch_block_t*) aligned_alloc(64, sizeof(epoch_block_t));
+      if (added == NULL) {
+        // nowhere to announce this thread's reads, so it can't go on
+        fprintf(stderr, "epoch: out of memory for thread slots\n");
+        abort();
+      }
+      memset(added, 0, sizeof(epoch_block_t));
+      // another thread may have added one first; then use theirs
+      if (__atomic_compare_exchange_n(&block->next, &next, added, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        next = added;
+      } else {
+        free(added);
+      }
+    }
+    block = next;
+  }
+}
+
+static void limbo_lock(epoch_slot_t *slot) {
+  while (__atomic_exchange_n(&slot->limboLock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&slot->limboLock, __ATOMIC_RELAXED)) {
+      sched_yield();
+    }
+  }
+}
+
+static void limbo_unlock(epoch_slot_t *slot) {
+  __atomic_store_n(&slot->limboLock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Moves the global epoch forward if every active thread has observed it.
+ * @return the (possibly new) global epoch
+ */
+static unsigned long try_advance() {
+  unsigned long epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+  // a light reader's announcement may still be sitting in its store
+  // buffer; this runs a full fence on every CPU running one of our threads
+  if (__atomic_load_n(&lightReads, __ATOMIC_ACQUIRE)) {
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+  }
+  for (epoch_block_t *block = &firstBlock; block != NULL; block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE)) {
+    for (int i = 0; i < EPOCH_BLOCK_SLOTS; i++) {
+      unsigned long state = __atomic_load_n(&block->slots[i].state, __ATOMIC_ACQUIRE);
+      // a thread still running in an older epoch holds everyone back
+      if ((state & 1) && (state >> 1) != epoch) {
+        return epoch;
+      }
+    }
+  }
+  __atomic_compare_exchange_n(&globalEpoch, &epoch, epoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Releases every node in a slot's limbo list that was retired at least two
+ * epochs before the given one. Caller holds the slot's limbo lock.
+ */
+static void collect(epoch_slot_t *slot, unsigned long epoch) {
+  while (slot->limboHead < slot->limboTail && slot->limbo[slot->limboHead].epoch + 2 <= epoch) {
+    retired_t *r = &slot->limbo[slot->limboHead++];
+    r->release(r->ptr);
+  }
+  // once the list is empty, rewind it so the array doesn't creep forward
+  if (slot->limboHead == slot->limboTail) {
+    slot->limboHead = 0;
+    slot->limboTail = 0;
+  }
+}
+
+/**
+ * Returns the calling thread's slot, claiming one if it has none yet. A
+ * thread that keeps it can use the *_slot calls and skip the lookup.
+ */
+epoch_slot_t *epoch_slot() {
+  return my_slot();
+}
+
+/**
+ * Enters a read-side critical section. Nodes reachable when this returns
+ * stay allocated until the matching epoch_exit(). Sections may nest.
+ */
+void epoch_enter() {
+  epoch_enter_slot(my_slot());
+}
+
+/**
+ * epoch_enter() for a thread that already has its slot.
+ */
+void epoch_enter_slot(epoch_slot_t *slot) {
+  if (slot->depth++ > 0) {
+    return;
+  }
+  unsigned long epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&slot->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+  // make the announcement visible before any shared node is read
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void init_light() {
+  if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+    __atomic_store_n(&lightReads, 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Turns on light read sections for the whole process, if the kernel has
+ * membarrier(). Call it before the structure its readers use is shared.
+ * @return 1 if they're on, 0 if epoch_enter_light() is a plain epoch_enter()
+ */
+int epoch_enable_light() {
+  pthread_once(&lightOnce, init_light);
+  return lightReads;
+}
+
+/**
+ * Enters a read-side critical section without a memory fence: the thread
+ * only stores its announcement to its own slot. The fence is paid by
+ * writers instead, when they try to advance the epoch, so this is for
+ * read-mostly structures. Leave with epoch_exit_slot().
+ */
+void epoch_enter_light(epoch_slot_t *slot) {
+  if (!__atomic_load_n(&lightReads, __ATOMIC_RELAXED)) {
+    epoch_enter_slot(slot);
+    return;
+  }
+  if (slot->depth++ > 0) {
+    return;
+  }
+  unsigned long epoch = __atomic_load_n(&globalEpoch, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+  // keep the compiler from hoisting the reads above the announcement
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Leaves a read-side critical section.
+ */
+void epoch_exit() {
+  epoch_exit_slot(my_slot());
+}
+
+void epoch_exit_slot(epoch_slot_t *slot) {
+  if (--slot->depth > 0) {
+    return;
+  }
+  __atomic_store_n(&slot->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Defers releasing a node until no reader can still hold a reference to it.
+ * The node must already be unreachable from the shared structure.
+ * @param ptr the node to release
+ * @param release the function that frees it (usually free)
+ */
+void epoch_retire(void *ptr, void (*release)(void*)) {
+  epoch_retire_slot(my_slot(), ptr, release);
+}
+
+/**
+ * epoch_retire() for a thread that already has its slot.
+ */
+void epoch_retire_slot(epoch_slot_t *slot, void *ptr, void (*release)(void*)) {
+  limbo_lock(slot);
+  // grow (or compact) the limbo array when it runs out of room
+  if (slot->limboTail == slot->limboCap) {
+    if (slot->limboHead > slot->limboCap / 2) {
+      int live = slot->limboTail - slot->limboHead;
+      for (int i = 0; i < live; i++) {
+        slot->limbo[i] = slot->limbo[slot->limboHead + i];
+      }
+      slot->limboHead = 0;
+      slot->limboTail = live;
+    } else {
+      int cap = slot->limboCap ? slot->limboCap * 2 : EPOCH_COLLECT_THRESHOLD * 2;
+      retired_t *limbo = (retired_t*) realloc(slot->limbo, cap * sizeof(retired_t));
+      if (limbo == NULL) {
+        // out of memory: leaking the node is the only safe option, since
+        // the caller may itself be inside a critical section
+        limbo_unlock(slot);
+        fprintf(stderr, "epoch_retire: out of memory, leaking %p\n", ptr);
+        return;
+      }
+      slot->limbo = limbo;
+      slot->limboCap = cap;
+    }
+  }
+  retired_t *r = &slot->limbo[slot->limboTail++];
+  r->ptr = ptr;
+  r->release = release;
+  r->epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+  if (slot->limboTail - slot->limboHead >= EPOCH_COLLECT_THRESHOLD) {
+    collect(slot, try_advance());
+  }
+  limbo_unlock(slot);
+}
+
+/**
+ * Releases whatever in the calling thread's limbo list has become safe to
+ * release, moving the epoch forward if it can, without waiting for anyone.
+ * @return the number of nodes still waiting
+ */
+int epoch_collect() {
+  epoch_slot_t *slot = my_slot();
+  limbo_lock(slot);
+  collect(slot, try_advance());
+  int pending = slot->limboTail - slot->limboHead;
+  limbo_unlock(slot);
+  return pending;
+}
+
+/**
+ * Waits until every reader that was inside a critical section when this
+ * was called has left it. Must not be called from inside a critical section.
+ */
+void epoch_synchronize() {
+  unsigned long target = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE) + 2;
+  while (try_advance() < target) {
+    sched_yield();
+  }
+}
+
+/**
+ * Waits for a grace period and then releases every node retired before the
+ * call, in every thread's limbo list. Used when tearing down a map so no
+ * retired node outlives the memory it refers to.
+ */
+void epoch_barrier() {
+  epoch_synchronize();
+  unsigned long epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+  for (epoch_block_t *block = &firstBlock; block != NULL; block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE)) {
+    for (int i = 0; i < EPOCH_BLOCK_SLOTS; i++) {
+      limbo_lock(&block->slots[i]);
+      collect(&block->slots[i], epoch);
+      limbo_unlock(&block->slots[i]);
+    }
+  }
+}
@@ -0,0 +1,35 @@
+/*
+ * ts_epoch.h
+ *
+ * Epoch-based reclamation shared by every map in the process. Readers that
+ * walk shared nodes without holding a bucket lock bracket the walk with
+ * epoch_enter()/epoch_exit(); writers hand unlinked nodes to epoch_retire()
+ * instead of free(), and the node is released once every reader that could
+ * still see it has left its critical section. Read-mostly structures can
+ * use light sections, whose readers skip the fence and leave it to the
+ * threads retiring nodes (epoch_enable_light()).
+ */
+
+#ifndef TS_EPOCH_H_
+#define TS_EPOCH_H_
+
+// thread slots the epoch system starts with; once every one is taken it
+// adds another block of this many, so any number of threads can be in it
+#define EPOCH_BLOCK_SLOTS 256
+
+struct epoch_slot_t;
+
+void epoch_enter();
+void epoch_exit();
+void epoch_retire(void *ptr, void (*release)(void*));
+struct epoch_slot_t *epoch_slot();
+void epoch_enter_slot(struct epoch_slot_t*);
+void epoch_exit_slot(struct epoch_slot_t*);
+int epoch_enable_light();
+void epoch_enter_light(struct epoch_slot_t*);
+void epoch_retire_slot(struct epoch_slot_t*, void*, void (*)(void*));
+int epoch_collect();
+void epoch_synchronize();
+void epoch_barrier();
+
+#endif /* TS_EPOCH_H_ */
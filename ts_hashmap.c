@@ -1,9 +1,184 @@
+#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include "ts_cache.h"
+#include "ts_epoch.h"
 #include "ts_hashmap.h"
+#include "ts_index.h"
+#include "ts_maint.h"
+#include "ts_registry.h"
+#include "ts_simd.h"
+#include "ts_slab.h"
+#include "ts_split.h"
+#include "ts_stream.h"
+
+// default number of lock stripes when the caller doesn't pick one
+#define DEFAULT_STRIPES 64
+
+// number of lookups get_batch/put_batch keep in flight at once
+#define BATCH_GROUP 8
+
+// number of keys get_batch hashes in one go
+#define BATCH_CHUNK 256
+
+// operations a thread tallies before adding them to an adaptive map's counters
+#define ADAPT_FLUSH 64
+
+// operations in one observation window of an adaptive map
+#define ADAPT_WINDOW 8192
+
+// percent of reads at which gets switch to optimistic reads, or at which
+// they do when more than ADAPT_CONTENDED percent of lock acquisitions wait
+#define ADAPT_READS_ON 90
+#define ADAPT_READS_ON_CONTENDED 70
+#define ADAPT_CONTENDED 5
+
+// percent of reads below which gets go back to taking the lock, and
+// percent of optimistic reads that may fall back before they do anyway
+#define ADAPT_READS_OFF 60
+#define ADAPT_RETRIES_OFF 10
+
+// average chain length at which an adaptive map doubles its table
+#define ADAPT_MAX_LOAD 2
+
+// largest table an adaptive map grows to
+#define ADAPT_MAX_CAPACITY (1 << 30)
+
+// buckets an operation migrates while a resize is in progress, and
+// buckets the maintenance thread migrates per pass
+#define MIGRATE_STEP 4
+#define MAINT_MIGRATE_STEP 256
+
+// buckets the maintenance thread checks for scattered chains per pass
+#define MAINT_DEFRAG_STEP 256
+
+// dead entries a TS_LAZY_DEL chain collects before the put or del that
+// finds them unlinks them all, and buckets the maintenance thread purges
+// of dead entries per pass
+#define LAZY_PURGE_AT 4
+#define MAINT_PURGE_STEP 256
+
+// how often a bounded operation tries its stripe lock before parking on it
+#define BOUNDED_SPINS 64
+
+// how often an optimistic get retries, and how far it walks, before
+// falling back to the lock
+#define OPTIMISTIC_TRIES 3
+#define OPTIMISTIC_MAX_STEPS 256
+
+// how much a fetch_add that waited for its stripe lock heats its key up
+// (one that didn't cools it by one), and the heat at which it's split
+#define SPLIT_HEAT_UP 4
+#define SPLIT_HOT 64
+
+// operations between checks for split keys that have cooled down, and the
+// percent of them a split key has to get to stay split
+#define SPLIT_COOL_OPS 65536
+#define SPLIT_COOL_PCT 2
+
+// operations a handle counts before adding them to the map's numOps, and
+// free entries it keeps for reuse
+#define HANDLE_FLUSH 64
+#define HANDLE_CACHE 32
+
+// left in an old bucket once its chain has moved to the doubled table
+#define MOVED ((ts_entry_t*) 1)
+
+// resize states
+#define RESIZE_IDLE 0
+#define RESIZE_PREPARING 1
+#define RESIZE_MIGRATING 2
+
+// What a TS_ADAPTIVE map tracks: counters for the current window, running
+// totals, the read mode, and the state of an in-progress resize. While a
+// resize runs, buckets of the old table are claimed in order and moved to
+// newTable one at a time, each under its stripe lock, leaving MOVED behind.
+// Every capacity is a multiple of numStripes, so a key keeps its stripe
+// across the doubling and one lock covers both of its buckets.
+typedef struct ts_adapt_t {
+  long reads;
+  long writes;
+  long contended;
+  long retries;
+  long window;
+  ts_stats_t total;
+  int optimistic;
+  unsigned tableSeq;
+  int resizing;
+  ts_entry_t **newTable;
+  int newCapacity;
+  int oldCapacity;
+  int migrateNext;
+  int migrateDone;
+} ts_adapt_t;
+
+// Entries del has unlinked and left for the maintenance thread, linked
+// through next and pushed under the stripe's lock. Padded per stripe.
+typedef struct ts_pending_t {
+  ts_entry_t *head;
+  long count;
+} __attribute__((aligned(64))) ts_pending_t;
+
+// What a TS_MAINTAIN map has queued up for its maintenance thread, and
+// what the thread has done so far. limbo counts entries the thread has
+// retired that are still waiting out their grace period, and purgeNext is
+// the next bucket it looks at for dead entries.
+typedef struct ts_backlog_t {
+  ts_pending_t *pending;
+  int wantResize;
+  int lastCool;
+  int limbo;
+  unsigned purgeNext;
+  long reclaimed;
+  long migrated;
+  long cooled;
+  long compacted;
+  long purged;
+} ts_backlog_t;
+
+// The calling thread's tally for the adaptive map it used last
+typedef struct tally_t {
+  ts_hashmap_t *map;
+  int reads;
+  int writes;
+  int contended;
+  int retries;
+  int longest;
+} tally_t;
+
+static __thread tally_t tally;
+
+// A thread's private context for one map: its share of the operation
+// count, its adaptive tally, a cache of free entries, its epoch slot and
+// its random seed, so the hot path needn't look any of them up
+struct ts_map_handle_t {
+  ts_hashmap_t *map;
+  int ops;
+  tally_t tally;
+  ts_entry_t *cache[HANDLE_CACHE];
+  int cached;
+  struct epoch_slot_t *slot;
+  unsigned seed;
+};
+
+static int maintain(void*);
+static int unlink_key(ts_hashmap_t*, ts_map_handle_t*, int, const struct timespec*, int*, int*);
+
+// A lookup in flight inside get_batch: which key it is, where it is in the
+// bucket, and whether it has its stripe lock yet
+typedef struct batch_slot_t {
+  int index;
+  int bucket;
+  int stripe;
+  int locked;
+  ts_entry_t *entry;
+} batch_slot_t;
 
 /**
  * Creates a new thread-safe hashmap. 
@@ -11,102 +186,1611 @@
  * @param capacity initial capacity of the hashmap.
  * @return a pointer to a new thread-safe hashmap.
  */
-ts_hashmap_t *initmap(int capacity) {
-  ts_hashmap_t *map = (ts_hashmap_t*) malloc(sizeof(ts_hashmap_t));
-  ts_entry_t **table = (ts_entry_t**) calloc(capacity, sizeof(ts_entry_t*));
-  map->table = table;
-  map->capacity = capacity;
-  map->size = 0;
-  map->numOps = 0;
-  return map;
+ts_hashmap_t *initmap(int capacity) {
+  ts_options_t opts = { .capacity = capacity };
+  return initmap_opts(&opts);
+}
+
+/**
+ * Creates a map, in a registry or (if registry is NULL) on its own.
+ */
+static ts_hashmap_t *create_map(ts_registry_t *registry, const ts_options_t *opts) {
+  int capacity = opts->capacity;
+  // the hashed layouts index with a mask, so they need a power of two
+  if (opts->hash != TS_HASH_MODULO) {
+    capacity = 1;
+    while (capacity < opts->capacity) {
+      capacity <<= 1;
+    }
+  }
+  if (registry != NULL && registry_full(registry, (long) capacity * sizeof(ts_entry_t*))) {
+    return NULL;
+  }
+  // aligned so the counters get their line to themselves
+  ts_hashmap_t *map = (ts_hashmap_t*) aligned_alloc(64, sizeof(ts_hashmap_t));
+  map->hash = opts->hash;
+  map->capacity = capacity;
+  map->size = 0;
+  map->numOps = 0;
+  map->flags = opts->flags;
+  // an RCU map's gets never take a lock and its chains are replaced
+  // rather than moved, so there's nothing for TS_ADAPTIVE to do
+  if (map->flags & TS_RCU) {
+    map->flags &= ~TS_ADAPTIVE;
+    epoch_enable_light();
+  }
+  // a registry's entries come from its own slabs
+  map->registry = registry;
+  if (registry != NULL) {
+    map->flags &= ~TS_LOCALITY;
+  }
+  // a resize would have to rebuild the stripes along with the table, and
+  // a stream ring or a slab for every few buckets would be far too many
+  if (map->flags & (TS_ADAPTIVE | TS_STREAM | TS_LOCALITY)) {
+    map->flags &= ~TS_COLOCATE;
+  }
+  // a colocated map's heads live in its stripes
+  ts_entry_t **table = NULL;
+  if (!(map->flags & TS_COLOCATE)) {
+    table = (ts_entry_t**) calloc(map->capacity, sizeof(ts_entry_t*));
+  }
+  map->table = table;
+  // more stripes than buckets would just be wasted locks
+  map->numStripes = opts->numStripes > 0 ? opts->numStripes
+      : registry != NULL ? REGISTRY_DEFAULT_STRIPES : DEFAULT_STRIPES;
+  if (map->flags & TS_COLOCATE) {
+    map->numStripes = (map->capacity + STRIPE_HEADS - 1) / STRIPE_HEADS;
+  }
+  if (map->numStripes > map->capacity) {
+    map->numStripes = map->capacity;
+  }
+  map->adapt = NULL;
+  if (map->flags & TS_ADAPTIVE) {
+    // a key has to keep its stripe when the table doubles, so the stripe
+    // count has to divide every capacity: a power of two for the masked
+    // layouts, and the modulo layout rounds its capacity up to a multiple
+    if (map->hash != TS_HASH_MODULO) {
+      while (map->numStripes & (map->numStripes - 1)) {
+        map->numStripes &= map->numStripes - 1;
+      }
+    } else if (map->capacity % map->numStripes != 0) {
+      map->capacity += map->numStripes - map->capacity % map->numStripes;
+      free(table);
+      table = (ts_entry_t**) calloc(map->capacity, sizeof(ts_entry_t*));
+      map->table = table;
+    }
+    map->adapt = (ts_adapt_t*) calloc(1, sizeof(ts_adapt_t));
+    map->adapt->newTable = table;
+    map->adapt->newCapacity = map->capacity;
+  }
+  map->lockType = opts->lockType;
+  map->stripes = (ts_stripe_t*) aligned_alloc(64, map->numStripes * sizeof(ts_stripe_t));
+  for (int i = 0; i < map->numStripes; i++) {
+    memset(map->stripes[i].heads, 0, sizeof(map->stripes[i].heads));
+    lock_init(&map->stripes[i].lock, map->lockType);
+    map->stripes[i].seq = 0;
+    map->stripes[i].hotKey = 0;
+    map->stripes[i].hotCount = 0;
+  }
+  map->slabs = NULL;
+  map->defragNext = 0;
+  if (map->flags & TS_LOCALITY) {
+    map->slabs = (ts_slab_t*) aligned_alloc(64, map->numStripes * sizeof(ts_slab_t));
+    for (int i = 0; i < map->numStripes; i++) {
+      slab_init(&map->slabs[i], sizeof(ts_entry_t));
+    }
+  }
+  map->hot = (ts_hotkeys_t*) calloc(1, sizeof(ts_hotkeys_t));
+  pthread_mutex_init(&map->hot->lock, NULL);
+  map->index = (map->flags & TS_INDEX) ? index_init() : NULL;
+  map->stream = (map->flags & TS_STREAM) ? stream_init(map->numStripes, opts->streamCapacity) : NULL;
+  map->cache = (map->flags & TS_CACHE) ? cache_init(opts->maxEntries > 0 ? opts->maxEntries : map->capacity) : NULL;
+  map->maint = NULL;
+  map->backlog = NULL;
+  map->pool = 0;
+  map->memory = 0;
+  if (map->flags & TS_MAINTAIN) {
+    map->backlog = (ts_backlog_t*) calloc(1, sizeof(ts_backlog_t));
+    map->backlog->pending = (ts_pending_t*) aligned_alloc(64, map->numStripes * sizeof(ts_pending_t));
+    memset(map->backlog->pending, 0, map->numStripes * sizeof(ts_pending_t));
+  }
+  // everything a maintenance thread touches has to be set up before it
+  // starts, or before the map joins a registry whose workers are running
+  if (registry != NULL) {
+    map->pool = registry_pool(registry, map->numStripes);
+    registry_charge(registry, &map->memory, (long) map->capacity * sizeof(ts_entry_t*));
+    int worker = registry_add(registry, map, map->backlog != NULL ? maintain : NULL);
+    if (worker >= 0) {
+      map->maint = registry->workers[worker].maint;
+    }
+  } else if (map->backlog != NULL) {
+    map->maint = maint_start(maintain, map, opts->maintBudget, opts->maintNice);
+  }
+  if (map->backlog != NULL && map->maint == NULL) {
+    free(map->backlog->pending);
+    free(map->backlog);
+    map->backlog = NULL;
+  }
+  return map;
+}
+
+/**
+ * Creates a new thread-safe hashmap with the given options.
+ *
+ * @param opts the capacity, stripes, flags, hash function and lock type to use
+ * @return a pointer to a new thread-safe hashmap.
+ */
+ts_hashmap_t *initmap_opts(const ts_options_t *opts) {
+  return create_map(NULL, opts);
+}
+
+/**
+ * Creates a new thread-safe hashmap in a registry (see ts_registry.h): its
+ * entries come from the registry's shared slabs, the registry's workers do
+ * its TS_MAINTAIN housekeeping, and it's charged for its table and
+ * entries against the registry's budget. TS_LOCALITY is ignored, and the
+ * map gets REGISTRY_DEFAULT_STRIPES stripes unless opts asks for more.
+ *
+ * @param registry the registry
+ * @param opts the capacity, stripes, flags, hash function and lock type to use
+ * @return a pointer to a new thread-safe hashmap, or NULL if its table
+ * would take the registry over its budget
+ */
+ts_hashmap_t *initmap_in(ts_registry_t *registry, const ts_options_t *opts) {
+  return create_map(registry, opts);
+}
+
+/**
+ * Returns the bucket a key belongs in for a table of the given capacity.
+ * The key is treated as unsigned so negative keys land in the table too,
+ * matching the batch kernels.
+ */
+static int bucket_in(ts_hashmap_t *map, int key, int capacity) {
+  switch (map->hash) {
+    case TS_HASH_MULT:
+      return hash_mult(key) & (capacity - 1);
+    case TS_HASH_MURMUR:
+      return hash_murmur(key) & (capacity - 1);
+    default:
+      return (unsigned) key % (unsigned) capacity;
+  }
+}
+
+/**
+ * Returns the bucket a key belongs in. On an adaptive map the capacity
+ * can change under us, but the bucket is only used to pick the stripe,
+ * which is the same for every capacity.
+ */
+static int bucket_of(ts_hashmap_t *map, int key) {
+  return bucket_in(map, key, __atomic_load_n(&map->capacity, __ATOMIC_RELAXED));
+}
+
+/**
+ * Reads the table and its capacity as a matching pair, and optionally the
+ * table a resize is moving it to (the table itself when none is running).
+ * Only an adaptive map ever changes them, bumping tableSeq around it.
+ */
+static void load_tables(ts_hashmap_t *map, ts_entry_t ***table, int *capacity,
+    ts_entry_t ***next, int *nextCapacity) {
+  ts_adapt_t *adapt = map->adapt;
+  if (adapt == NULL) {
+    *table = map->table;
+    *capacity = map->capacity;
+    return;
+  }
+  unsigned seq;
+  do {
+    seq = __atomic_load_n(&adapt->tableSeq, __ATOMIC_ACQUIRE);
+    *table = __atomic_load_n(&map->table, __ATOMIC_RELAXED);
+    *capacity = __atomic_load_n(&map->capacity, __ATOMIC_RELAXED);
+    if (next != NULL) {
+      *next = __atomic_load_n(&adapt->newTable, __ATOMIC_RELAXED);
+      *nextCapacity = __atomic_load_n(&adapt->newCapacity, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || __atomic_load_n(&adapt->tableSeq, __ATOMIC_RELAXED) != seq);
+}
+
+static void load_table(ts_hashmap_t *map, ts_entry_t ***table, int *capacity) {
+  load_tables(map, table, capacity, NULL, NULL);
+}
+
+/**
+ * Returns the slot holding the head of a bucket's chain in a table. A
+ * TS_COLOCATE map keeps its heads in its stripes instead (and it never has
+ * a second table).
+ */
+static ts_entry_t **head_of(ts_hashmap_t *map, ts_entry_t **table, int bucket) {
+  if (map->flags & TS_COLOCATE) {
+    return &map->stripes[bucket / STRIPE_HEADS].heads[bucket % STRIPE_HEADS];
+  }
+  return &table[bucket];
+}
+
+/**
+ * Returns the slot holding the head of a key's chain. The caller holds the
+ * key's stripe lock, so the chain can't move while it's being used.
+ */
+static ts_entry_t **chain_of(ts_hashmap_t *map, int key) {
+  ts_entry_t **table;
+  int capacity;
+  load_table(map, &table, &capacity);
+  ts_entry_t **slot = head_of(map, table, bucket_in(map, key, capacity));
+  // the bucket has already been migrated to the doubled table
+  if (*slot == MOVED) {
+    slot = &map->adapt->newTable[bucket_in(map, key, map->adapt->newCapacity)];
+  }
+  return slot;
+}
+
+/**
+ * Computes the buckets for a run of keys with the map's vector kernel.
+ */
+static void bucket_batch(ts_hashmap_t *map, const int *keys, int *buckets, int n) {
+  switch (map->hash) {
+    case TS_HASH_MULT:
+      mult_batch(keys, buckets, n, map->capacity - 1);
+      break;
+    case TS_HASH_MURMUR:
+      murmur_batch(keys, buckets, n, map->capacity - 1);
+      break;
+    default:
+      hash_batch(keys, buckets, n, map->capacity);
+  }
+}
+
+/**
+ * Returns the lock stripe that protects the given bucket.
+ */
+static int stripe_of(ts_hashmap_t *map, int bucket) {
+  if (map->flags & TS_COLOCATE) {
+    return bucket / STRIPE_HEADS;
+  }
+  return bucket % map->numStripes;
+}
+
+/**
+ * What frees an entry on this map: slab_free for a TS_LOCALITY map or one
+ * in a registry, whose entries come from slabs, otherwise free.
+ */
+static void (*entry_free(ts_hashmap_t *map))(void*) {
+  return map->slabs != NULL || map->registry != NULL ? slab_free : free;
+}
+
+/**
+ * Releases an entry that has been unlinked from its bucket, unless it's an
+ * intrusive node, which is left to its owner. Range scans,
+ * optimistic gets and RCU gets read entries without taking bucket locks,
+ * and so do increments of a split key, so an indexed, adaptive or RCU map,
+ * or an entry that was split, has to wait for them before the memory can
+ * be reused.
+ */
+static void release_entry(ts_hashmap_t *map, ts_map_handle_t *h, ts_entry_t *entry, int wasSplit) {
+  // the caller's node; its memory isn't ours to reuse
+  if (entry->flags & TS_ENTRY_INTRUSIVE) {
+    return;
+  }
+  if (map->registry != NULL) {
+    registry_charge(map->registry, &map->memory, -(long) sizeof(ts_entry_t));
+  }
+  if (map->index != NULL || map->adapt != NULL || (map->flags & TS_RCU) || wasSplit) {
+    if (h != NULL) {
+      epoch_retire_slot(h->slot, entry, entry_free(map));
+    } else {
+      epoch_retire(entry, entry_free(map));
+    }
+  } else if (map->slabs != NULL || map->registry != NULL) {
+    // back to its own stripe's slab, not to a cache that any bucket uses
+    slab_free(entry);
+  } else if (h != NULL && h->cached < HANDLE_CACHE) {
+    // nobody can be looking at it: keep it for this thread's next insert
+    h->cache[h->cached++] = entry;
+  } else {
+    free(entry);
+  }
+}
+
+/**
+ * Allocates an entry for a bucket of the given stripe: on a TS_LOCALITY
+ * map from the stripe's slab, or on a map in a registry from the
+ * registry's slab for the stripe, next to near (an entry of the same
+ * chain) if there's room; otherwise from the handle's cache when it has
+ * one. Called with the stripe lock held.
+ */
+static ts_entry_t *alloc_entry(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t *near) {
+  // an intrusive node isn't on a slab page
+  if (near != NULL && (near->flags & TS_ENTRY_INTRUSIVE)) {
+    near = NULL;
+  }
+  if (map->slabs != NULL) {
+    return slab_alloc(&map->slabs[stripe], near);
+  }
+  if (map->registry != NULL) {
+    registry_charge(map->registry, &map->memory, sizeof(ts_entry_t));
+    return registry_alloc(map->registry, map->pool + stripe, near);
+  }
+  if (h != NULL && h->cached > 0) {
+    return h->cache[--h->cached];
+  }
+  return malloc(sizeof(ts_entry_t));
+}
+
+/**
+ * Whether a lazy del has marked an entry deleted. A reader without the
+ * lock that sees the entry live also sees the value it was revived with.
+ */
+static int entry_dead(ts_entry_t *entry) {
+  return __atomic_load_n(&entry->flags, __ATOMIC_ACQUIRE) & TS_ENTRY_DEAD;
+}
+
+/**
+ * Enters and leaves an epoch through the handle's slot if there is one.
+ */
+static void enter(ts_map_handle_t *h) {
+  if (h != NULL) {
+    epoch_enter_slot(h->slot);
+  } else {
+    epoch_enter();
+  }
+}
+
+static void leave(ts_map_handle_t *h) {
+  if (h != NULL) {
+    epoch_exit_slot(h->slot);
+  } else {
+    epoch_exit();
+  }
+}
+
+/**
+ * Takes a stripe lock. Writers, and readers on an adaptive map, try first
+ * so they can tell whether the lock was contended.
+ * @return 1 if the caller had to wait for the lock, 0 otherwise
+ */
+static int lock_stripe(ts_hashmap_t *map, ts_lock_t *lock, int write) {
+  if (write) {
+    if (lock_try_write(lock) == 0) {
+      return 0;
+    }
+    lock_write(lock);
+    return 1;
+  }
+  if (map->adapt != NULL && lock_try_read(lock) == 0) {
+    return 0;
+  }
+  lock_read(lock);
+  return map->adapt != NULL;
+}
+
+// the deadline of try_get/try_put/try_del: one try, no waiting
+static const struct timespec noWait = { 0, 0 };
+
+/**
+ * Takes a stripe lock like lock_stripe, but only until a deadline: tries
+ * it BOUNDED_SPINS times, then parks on it until the deadline passes.
+ * With noWait it tries just once; with no deadline it's lock_stripe.
+ * @param until an absolute CLOCK_REALTIME deadline, noWait, or NULL
+ * @return 1 if the caller had to wait, 0 if not, -1 if the deadline passed
+ */
+static int lock_stripe_until(ts_hashmap_t *map, ts_lock_t *lock, int write, const struct timespec *until) {
+  if (until == NULL) {
+    return lock_stripe(map, lock, write);
+  }
+  for (int i = 0; i < BOUNDED_SPINS; i++) {
+    if ((write ? lock_try_write(lock) : lock_try_read(lock)) == 0) {
+      return i > 0;
+    }
+    if (until == &noWait) {
+      return -1;
+    }
+  }
+  if ((write ? lock_timed_write(lock, until) : lock_timed_read(lock, until)) != 0) {
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * Marks the start and end of a structural change to a stripe's chains, so
+ * optimistic gets that overlap it know to retry. Value updates are single
+ * atomic stores and don't need this.
+ */
+static void write_begin(ts_hashmap_t *map, ts_stripe_t *stripe) {
+  if (map->adapt != NULL) {
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+}
+
+static void write_end(ts_hashmap_t *map, ts_stripe_t *stripe) {
+  if (map->adapt != NULL) {
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Takes a stripe lock for housekeeping. Spinning on a spinlock whose
+ * holder has been preempted would burn the rest of a timeslice, so this
+ * tries and yields instead.
+ */
+static void lock_yielding(ts_lock_t *lock) {
+  while (lock_try_write(lock) != 0) {
+    sched_yield();
+  }
+}
+
+/**
+ * Moves one bucket of the old table into the doubled one. Its entries go
+ * to one of two buckets, both covered by the same stripe lock; dead ones
+ * are dropped on the way.
+ */
+static void migrate_bucket(ts_hashmap_t *map, int bucket) {
+  ts_adapt_t *adapt = map->adapt;
+  ts_stripe_t *stripe = &map->stripes[bucket % map->numStripes];
+  lock_yielding(&stripe->lock);
+  write_begin(map, stripe);
+  ts_entry_t *entry = map->table[bucket];
+  while (entry != NULL) {
+    ts_entry_t *next = entry->next;
+    if (entry->flags & TS_ENTRY_DEAD) {
+      // a lazily deleted entry isn't worth taking along
+      if (map->index != NULL) {
+        index_remove(map->index, entry->key);
+      }
+      release_entry(map, NULL, entry, 0);
+    } else {
+      ts_entry_t **slot = &adapt->newTable[bucket_in(map, entry->key, adapt->newCapacity)];
+      __atomic_store_n(&entry->next, *slot, __ATOMIC_RELAXED);
+      __atomic_store_n(slot, entry, __ATOMIC_RELEASE);
+    }
+    entry = next;
+  }
+  __atomic_store_n(&map->table[bucket], MOVED, __ATOMIC_RELEASE);
+  write_end(map, stripe);
+  unlock(&stripe->lock);
+}
+
+/**
+ * Swaps in the doubled table once every bucket has moved. A locked
+ * operation that read the old table pointer still holds its stripe lock,
+ * so taking each lock once waits them all out; optimistic gets are
+ * covered by retiring the old table through the epoch system.
+ */
+static void finish_resize(ts_hashmap_t *map) {
+  ts_adapt_t *adapt = map->adapt;
+  ts_entry_t **old = map->table;
+  __atomic_store_n(&adapt->tableSeq, adapt->tableSeq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&map->table, adapt->newTable, __ATOMIC_RELAXED);
+  __atomic_store_n(&map->capacity, adapt->newCapacity, __ATOMIC_RELAXED);
+  __atomic_store_n(&adapt->tableSeq, adapt->tableSeq + 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < map->numStripes; i++) {
+    lock_yielding(&map->stripes[i].lock);
+    unlock(&map->stripes[i].lock);
+  }
+  epoch_retire(old, free);
+  if (map->registry != NULL) {
+    registry_charge(map->registry, &map->memory, -(long) adapt->oldCapacity * sizeof(ts_entry_t*));
+  }
+  __atomic_fetch_add(&adapt->total.resizes, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&adapt->resizing, RESIZE_IDLE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Starts doubling the table. Nothing moves yet: operations migrate a few
+ * buckets each from now on (see help_resize), so traffic never pauses.
+ */
+static void start_resize(ts_hashmap_t *map) {
+  ts_adapt_t *adapt = map->adapt;
+  int idle = RESIZE_IDLE;
+  if (!__atomic_compare_exchange_n(&adapt->resizing, &idle, RESIZE_PREPARING, 0,
+      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return;
+  }
+  // only a resize changes the capacity, and none is running
+  int capacity = map->capacity;
+  long bytes = 2 * (long) capacity * sizeof(ts_entry_t*);
+  // a map in a registry stops growing once the budget is used up
+  if (map->registry != NULL && registry_full(map->registry, bytes)) {
+    __atomic_store_n(&adapt->resizing, RESIZE_IDLE, __ATOMIC_RELEASE);
+    return;
+  }
+  ts_entry_t **bigger = (ts_entry_t**) calloc(2 * (size_t) capacity, sizeof(ts_entry_t*));
+  if (bigger == NULL) {
+    __atomic_store_n(&adapt->resizing, RESIZE_IDLE, __ATOMIC_RELEASE);
+    return;
+  }
+  if (map->registry != NULL) {
+    registry_charge(map->registry, &map->memory, bytes);
+  }
+  __atomic_store_n(&adapt->tableSeq, adapt->tableSeq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&adapt->newTable, bigger, __ATOMIC_RELAXED);
+  __atomic_store_n(&adapt->newCapacity, 2 * capacity, __ATOMIC_RELAXED);
+  __atomic_store_n(&adapt->tableSeq, adapt->tableSeq + 1, __ATOMIC_RELEASE);
+  adapt->oldCapacity = capacity;
+  adapt->migrateNext = 0;
+  adapt->migrateDone = 0;
+  __atomic_store_n(&adapt->resizing, RESIZE_MIGRATING, __ATOMIC_RELEASE);
+}
+
+/**
+ * Migrates the next few buckets of an in-progress resize, and finishes
+ * it if this call moved the last one.
+ * @return the number of buckets this call moved
+ */
+static int help_resize(ts_hashmap_t *map, int steps) {
+  ts_adapt_t *adapt = map->adapt;
+  for (int i = 0; i < steps; i++) {
+    int bucket = __atomic_fetch_add(&adapt->migrateNext, 1, __ATOMIC_RELAXED);
+    if (bucket >= adapt->oldCapacity) {
+      return i;
+    }
+    migrate_bucket(map, bucket);
+    if (__atomic_add_fetch(&adapt->migrateDone, 1, __ATOMIC_ACQ_REL) == adapt->oldCapacity) {
+      finish_resize(map);
+      return i + 1;
+    }
+  }
+  return steps;
+}
+
+/**
+ * Looks at the window that just closed and picks the backend for the next
+ * one: optimistic gets when reads dominate (or mostly dominate and the
+ * locks are contended), locked gets when writes pick up or optimistic
+ * reads keep losing races, and a bigger table when chains get long.
+ */
+static void adapt_window(ts_hashmap_t *map) {
+  ts_adapt_t *adapt = map->adapt;
+  long reads = __atomic_exchange_n(&adapt->reads, 0, __ATOMIC_RELAXED);
+  long writes = __atomic_exchange_n(&adapt->writes, 0, __ATOMIC_RELAXED);
+  long contended = __atomic_exchange_n(&adapt->contended, 0, __ATOMIC_RELAXED);
+  long retries = __atomic_exchange_n(&adapt->retries, 0, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->total.reads, reads, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->total.writes, writes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->total.contended, contended, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->total.retries, retries, __ATOMIC_RELAXED);
+  long ops = reads + writes;
+  if (ops == 0) {
+    return;
+  }
+  long readPct = 100 * reads / ops;
+  int optimistic = __atomic_load_n(&adapt->optimistic, __ATOMIC_RELAXED);
+  if (!optimistic) {
+    if (readPct >= ADAPT_READS_ON
+        || (readPct >= ADAPT_READS_ON_CONTENDED && 100 * contended > ADAPT_CONTENDED * ops)) {
+      __atomic_store_n(&adapt->optimistic, 1, __ATOMIC_RELAXED);
+    }
+  } else if (readPct < ADAPT_READS_OFF || 100 * retries > ADAPT_RETRIES_OFF * (reads + 1)) {
+    __atomic_store_n(&adapt->optimistic, 0, __ATOMIC_RELAXED);
+  }
+  int capacity = __atomic_load_n(&map->capacity, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&map->size, __ATOMIC_RELAXED) > (long) capacity * ADAPT_MAX_LOAD
+      && capacity <= ADAPT_MAX_CAPACITY / 2) {
+    // allocating the new table is housekeeping too
+    if (map->maint != NULL) {
+      __atomic_store_n(&map->backlog->wantResize, 1, __ATOMIC_RELAXED);
+      maint_wake(map->maint);
+    } else {
+      start_resize(map);
+    }
+  }
+}
+
+/**
+ * Adds a tally's counts to its adaptive map and clears it; whoever closes
+ * a window runs the policy.
+ */
+static void flush_tally(ts_hashmap_t *map, tally_t *t) {
+  ts_adapt_t *adapt = map->adapt;
+  int n = t->reads + t->writes;
+  __atomic_fetch_add(&adapt->reads, t->reads, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->writes, t->writes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->contended, t->contended, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&adapt->retries, t->retries, __ATOMIC_RELAXED);
+  if (t->longest > __atomic_load_n(&adapt->total.longestChain, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&adapt->total.longestChain, t->longest, __ATOMIC_RELAXED);
+  }
+  memset(t, 0, sizeof(tally_t));
+  t->map = map;
+  long seen = __atomic_add_fetch(&adapt->window, n, __ATOMIC_RELAXED);
+  if (seen >= ADAPT_WINDOW
+      && __atomic_compare_exchange_n(&adapt->window, &seen, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    adapt_window(map);
+  }
+}
+
+/**
+ * Counts an operation on an adaptive map. Counts pile up per thread and
+ * are added to the map every ADAPT_FLUSH operations, so the shared
+ * counters aren't touched on every call; whoever closes a window runs the
+ * policy. Every operation also lends a hand to a running resize, unless
+ * a maintenance thread is doing it or help is 0 (the caller is bounded).
+ * Does nothing on other maps.
+ */
+static void tally_op(ts_hashmap_t *map, ts_map_handle_t *h, int write, int contended, int retried, int chain, int help) {
+  ts_adapt_t *adapt = map->adapt;
+  if (adapt == NULL) {
+    return;
+  }
+  // a handle carries its own tally; otherwise it's thread-local
+  tally_t *t = h != NULL ? &h->tally : &tally;
+  if (t->map != map) {
+    // the last map may be gone by now; drop what was counted for it
+    memset(t, 0, sizeof(tally_t));
+    t->map = map;
+  }
+  if (write) {
+    t->writes++;
+  } else {
+    t->reads++;
+  }
+  t->contended += contended;
+  t->retries += retried;
+  if (chain > t->longest) {
+    t->longest = chain;
+  }
+  if (t->reads + t->writes >= ADAPT_FLUSH) {
+    flush_tally(map, t);
+  }
+  if (help && map->maint == NULL && __atomic_load_n(&adapt->resizing, __ATOMIC_ACQUIRE) == RESIZE_MIGRATING) {
+    help_resize(map, MIGRATE_STEP);
+  }
+}
+
+/**
+ * Looks a key up without taking its stripe lock: walks the chain inside
+ * an epoch (so nothing it reaches is freed) and checks the stripe's
+ * sequence number didn't change under it. Gives up after a few lost
+ * races or on a very long chain.
+ * @param value where to store the value, or INT_MAX if the key isn't there
+ * @param chain where to store how many entries the walk visited
+ * @return 1 if the lookup is valid, 0 if the caller has to take the lock
+ */
+static int get_optimistic(ts_hashmap_t *map, ts_map_handle_t *h, int key, int bucket, int *value, int *chain) {
+  ts_stripe_t *stripe = &map->stripes[bucket % map->numStripes];
+  int valid = 0;
+  enter(h);
+  for (int attempt = 0; attempt < OPTIMISTIC_TRIES && !valid; attempt++) {
+    unsigned seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      continue;
+    }
+    ts_entry_t **table;
+    ts_entry_t **next;
+    int capacity;
+    int nextCapacity;
+    load_tables(map, &table, &capacity, &next, &nextCapacity);
+    ts_entry_t *entry = __atomic_load_n(&table[bucket_in(map, key, capacity)], __ATOMIC_ACQUIRE);
+    // migrated already: the chain is in the table being resized to. If
+    // that resize started after our snapshot, the migration also bumped
+    // the stripe's seq and the walk below fails validation.
+    if (entry == MOVED) {
+      entry = __atomic_load_n(&next[bucket_in(map, key, nextCapacity)], __ATOMIC_ACQUIRE);
+      if (entry == MOVED) {
+        continue;
+      }
+    }
+    int result = INT_MAX;
+    int steps = 0;
+    while (entry != NULL && steps < OPTIMISTIC_MAX_STEPS) {
+      steps++;
+      if (entry->key == key) {
+        if (!entry_dead(entry)) {
+          result = entry_value(entry);
+        }
+        break;
+      }
+      entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+    }
+    if (steps == OPTIMISTIC_MAX_STEPS) {
+      break;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&stripe->seq, __ATOMIC_RELAXED) == seq) {
+      *value = result;
+      *chain = steps;
+      valid = 1;
+    }
+  }
+  leave(h);
+  return valid;
+}
+
+/**
+ * Returns the number of slots to give a split: one per CPU.
+ */
+static int num_cpus() {
+  static int cpus = 0;
+  if (cpus == 0) {
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    cpus = n > 0 ? n : 1;
+  }
+  return cpus;
+}
+
+/**
+ * Splits an entry into per-core sub-values. Called with the entry's stripe
+ * lock held. Does nothing if the map already has SPLIT_MAX_KEYS split.
+ */
+static void split_entry(ts_hashmap_t *map, ts_entry_t *entry) {
+  ts_hotkeys_t *hot = map->hot;
+  pthread_mutex_lock(&hot->lock);
+  for (int i = 0; i < SPLIT_MAX_KEYS; i++) {
+    if (hot->splits[i] == NULL) {
+      ts_split_t *split = split_create(num_cpus());
+      split->entry = entry;
+      split->key = entry->key;
+      split->lastOps = __atomic_load_n(&map->numOps, __ATOMIC_RELAXED);
+      __atomic_store_n(&entry->split, split, __ATOMIC_RELEASE);
+      __atomic_store_n(&hot->splits[i], split, __ATOMIC_RELEASE);
+      __atomic_fetch_add(&hot->count, 1, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&hot->lock);
+}
+
+/**
+ * Ends an entry's split. Called with the entry's stripe lock held. Adders
+ * that raced with this see closed and re-apply their increment under the
+ * lock, so nothing is lost; the caller folds what was in the slots into
+ * the value. The entry must go through the epoch system when it's freed,
+ * since an adder may still be reading it.
+ * @return the sum that was in the slots
+ */
+static long unsplit_entry(ts_hashmap_t *map, ts_entry_t *entry) {
+  ts_hotkeys_t *hot = map->hot;
+  ts_split_t *split = entry->split;
+  __atomic_store_n(&split->closed, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&hot->lock);
+  for (int i = 0; i < SPLIT_MAX_KEYS; i++) {
+    if (hot->splits[i] == split) {
+      __atomic_store_n(&hot->splits[i], NULL, __ATOMIC_RELEASE);
+      __atomic_fetch_sub(&hot->count, 1, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&hot->lock);
+  __atomic_store_n(&entry->split, NULL, __ATOMIC_RELEASE);
+  long sum = split_drain(split);
+  epoch_retire(split, free);
+  return sum;
+}
+
+/**
+ * Keeps score of which key's fetch_adds wait for the stripe lock, and
+ * splits it once it's clearly the one the stripe is fighting over.
+ * Called with the stripe lock held.
+ */
+static void note_add(ts_hashmap_t *map, ts_stripe_t *stripe, ts_entry_t *entry, int contended) {
+  // a split holds on to its entry, which an RCU map replaces on every add;
+  // and adds to a split key skip the stripe lock, and with it the stripe's
+  // change stream ring, which only the lock holder may append to
+  if (map->flags & (TS_RCU | TS_STREAM)) {
+    return;
+  }
+  if (stripe->hotKey != entry->key) {
+    if (!contended) {
+      return;
+    }
+    stripe->hotKey = entry->key;
+    stripe->hotCount = 0;
+  }
+  if (contended) {
+    stripe->hotCount += SPLIT_HEAT_UP;
+  } else if (stripe->hotCount > 0) {
+    stripe->hotCount--;
+  }
+  if (stripe->hotCount >= SPLIT_HOT && entry->split == NULL) {
+    stripe->hotCount = 0;
+    split_entry(map, entry);
+  }
+}
+
+/**
+ * Folds a split key back into a plain entry if it's still split. Keys are
+ * never split on a TS_STREAM map, so the fold isn't a change to record.
+ * @return 1 if it was, 0 if someone else got there first
+ */
+static int unsplit_key(ts_hashmap_t *map, int key, ts_split_t *split) {
+  int stripe = stripe_of(map, bucket_of(map, key));
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  lock_write(lock);
+  ts_entry_t *entry = *chain_of(map, key);
+  while (entry != NULL && entry->key != key) {
+    entry = entry->next;
+  }
+  int folded = entry != NULL && entry->split == split;
+  if (folded) {
+    write_begin(map, &map->stripes[stripe]);
+    int value = (int) (entry->value + unsplit_entry(map, entry));
+    __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+    write_end(map, &map->stripes[stripe]);
+  }
+  unlock(lock);
+  return folded;
+}
+
+/**
+ * Ends the split of any key that got fewer than SPLIT_COOL_PCT percent of
+ * the map's operations since it was last checked. One thread at a time.
+ * @return the number of keys un-split
+ */
+static int cool_splits(ts_hashmap_t *map) {
+  ts_hotkeys_t *hot = map->hot;
+  int idle = 0;
+  int cooled = 0;
+  if (!__atomic_compare_exchange_n(&hot->cooling, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  int ops = __atomic_load_n(&map->numOps, __ATOMIC_RELAXED);
+  for (int i = 0; i < SPLIT_MAX_KEYS; i++) {
+    int cold = 0;
+    int key = 0;
+    epoch_enter();
+    ts_split_t *split = __atomic_load_n(&hot->splits[i], __ATOMIC_ACQUIRE);
+    if (split != NULL && ops - split->lastOps >= SPLIT_COOL_OPS) {
+      long adds = split_adds(split);
+      if ((adds - split->lastAdds) * 100 < (long) (ops - split->lastOps) * SPLIT_COOL_PCT) {
+        cold = 1;
+        key = split->key;
+      } else {
+        split->lastOps = ops;
+        split->lastAdds = adds;
+      }
+    }
+    epoch_exit();
+    // the split is only compared against from here on, never read
+    if (cold) {
+      cooled += unsplit_key(map, key, split);
+    }
+  }
+  __atomic_store_n(&hot->cooling, 0, __ATOMIC_RELEASE);
+  return cooled;
+}
+
+/**
+ * Counts operations, and every SPLIT_COOL_OPS of them looks for split keys
+ * that have cooled down (unless a maintenance thread does that, or help is
+ * 0 because the caller is bounded). Called before any lock is taken.
+ */
+static void count_op(ts_hashmap_t *map, ts_map_handle_t *h, int n, int help) {
+  // a handle adds its count in batches
+  if (h != NULL) {
+    h->ops += n;
+    if (h->ops < HANDLE_FLUSH) {
+      return;
+    }
+    n = h->ops;
+    h->ops = 0;
+  }
+  int ops = __atomic_add_fetch(&map->numOps, n, __ATOMIC_RELAXED);
+  if (help && map->maint == NULL && __atomic_load_n(&map->hot->count, __ATOMIC_RELAXED) > 0
+      && (unsigned) ops % SPLIT_COOL_OPS < (unsigned) n) {
+    cool_splits(map);
+  }
+}
+
+/**
+ * Unlinks every dead entry of a TS_LAZY_DEL chain in one go, under one
+ * bump of the stripe's sequence number. An RCU map's chains can't change
+ * in place, so there the prefix up to the last dead entry is copied
+ * without them and swapped in like in rcu_replace. Called with the stripe
+ * lock held.
+ * @return the number of entries unlinked
+ */
+static int purge_chain(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t **head) {
+  int purged = 0;
+  if (map->flags & TS_RCU) {
+    ts_entry_t *last = NULL;
+    for (ts_entry_t *entry = *head; entry != NULL; entry = entry->next) {
+      if (entry->flags & TS_ENTRY_DEAD) {
+        last = entry;
+      }
+    }
+    if (last == NULL) {
+      return 0;
+    }
+    ts_entry_t *end = last->next;
+    ts_entry_t *first = NULL;
+    ts_entry_t **link = &first;
+    ts_entry_t *old = *head;
+    for (ts_entry_t *curr = old; curr != end; curr = curr->next) {
+      if (!(curr->flags & TS_ENTRY_DEAD)) {
+        ts_entry_t *copy = alloc_entry(map, h, stripe, curr);
+        *copy = *curr;
+        *link = copy;
+        link = &copy->next;
+      }
+    }
+    *link = end;
+    __atomic_store_n(head, first, __ATOMIC_RELEASE);
+    ts_entry_t *copy = first;
+    while (old != end) {
+      ts_entry_t *next = old->next;
+      if (old->flags & TS_ENTRY_DEAD) {
+        if (map->index != NULL) {
+          index_remove(map->index, old->key);
+        }
+        purged++;
+      } else {
+        if (map->index != NULL) {
+          index_replace(map->index, copy);
+        }
+        copy = copy->next;
+      }
+      release_entry(map, h, old, 0);
+      old = next;
+    }
+    return purged;
+  }
+  write_begin(map, &map->stripes[stripe]);
+  ts_entry_t **link = head;
+  while (*link != NULL) {
+    ts_entry_t *entry = *link;
+    if (!(entry->flags & TS_ENTRY_DEAD)) {
+      link = &entry->next;
+      continue;
+    }
+    // entry->next stays put for any reader still standing on the entry
+    __atomic_store_n(link, entry->next, __ATOMIC_RELAXED);
+    if (map->index != NULL) {
+      index_remove(map->index, entry->key);
+    }
+    release_entry(map, h, entry, 0);
+    purged++;
+  }
+  write_end(map, &map->stripes[stripe]);
+  return purged;
+}
+
+/**
+ * Runs purge_chain over the next few buckets of a TS_LAZY_DEL map for the
+ * maintenance thread, carrying on from where its last pass left off and
+ * skipping busy stripes.
+ * @return the number of entries unlinked
+ */
+static int purge(ts_hashmap_t *map, int buckets) {
+  int purged = 0;
+  for (int i = 0; i < buckets; i++) {
+    ts_entry_t **table;
+    int capacity;
+    load_table(map, &table, &capacity);
+    int bucket = map->backlog->purgeNext++ % (unsigned) capacity;
+    int stripe = stripe_of(map, bucket);
+    ts_lock_t *lock = &map->stripes[stripe].lock;
+    if (lock_try_write(lock) != 0) {
+      continue;
+    }
+    // the table may have doubled since we picked the bucket
+    load_table(map, &table, &capacity);
+    ts_entry_t **head = head_of(map, table, bucket);
+    if (*head != MOVED) {
+      purged += purge_chain(map, NULL, stripe, head);
+    }
+    unlock(lock);
+  }
+  return purged;
+}
+
+/**
+ * Moves a bucket's chain into consecutive entries of its stripe's slab, in
+ * chain order, so a walk down it touches as few cache lines as it can. A
+ * chain that is already laid out that way, holds a split key or an
+ * intrusive node, or wouldn't fit on one slab page is left alone. The old entries are released like
+ * deleted ones, so readers still on them can finish their walk.
+ * @param wait whether to wait for the stripe lock or skip a busy stripe
+ * @return 1 if the chain was moved, 0 otherwise
+ */
+static int defrag_bucket(ts_hashmap_t *map, int bucket, int wait) {
+  int stripe = stripe_of(map, bucket);
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  if (wait) {
+    lock_stripe(map, lock, 1);
+  } else if (lock_try_write(lock) != 0) {
+    return 0;
+  }
+  // the table may have doubled since the caller picked the bucket
+  ts_entry_t **table;
+  int capacity;
+  load_table(map, &table, &capacity);
+  if (bucket >= capacity || table[bucket] == MOVED) {
+    unlock(lock);
+    return 0;
+  }
+  ts_entry_t **head = &table[bucket];
+  // dead entries don't get copied
+  if (map->flags & TS_LAZY_DEL) {
+    purge_chain(map, NULL, stripe, head);
+  }
+  ts_slab_t *slab = &map->slabs[stripe];
+  int length = 0;
+  int scattered = 0;
+  int pinned = 0;
+  for (ts_entry_t *entry = *head; entry != NULL; entry = entry->next) {
+    length++;
+    pinned |= entry->split != NULL || (entry->flags & TS_ENTRY_INTRUSIVE);
+    scattered |= entry->next != NULL && entry->next != entry + 1;
+  }
+  if (!scattered || pinned || length > slab_run_max(slab)) {
+    unlock(lock);
+    return 0;
+  }
+  ts_entry_t *run = slab_alloc_run(slab, length);
+  ts_entry_t *old = *head;
+  for (int i = 0; i < length; i++, old = old->next) {
+    run[i] = *old;
+    run[i].next = i + 1 < length ? &run[i + 1] : NULL;
+  }
+  old = *head;
+  write_begin(map, &map->stripes[stripe]);
+  __atomic_store_n(head, run, __ATOMIC_RELEASE);
+  write_end(map, &map->stripes[stripe]);
+  for (int i = 0; i < length; i++) {
+    ts_entry_t *next = old->next;
+    if (map->index != NULL) {
+      index_replace(map->index, &run[i]);
+    }
+    release_entry(map, NULL, old, 0);
+    old = next;
+  }
+  unlock(lock);
+  return 1;
+}
+
+/**
+ * Runs defrag_bucket over the next few buckets, carrying on from where the
+ * last call left off and wrapping around at the end of the table.
+ * @return the number of chains moved
+ */
+static int defrag(ts_hashmap_t *map, int buckets, int wait) {
+  int moved = 0;
+  for (int i = 0; i < buckets; i++) {
+    ts_entry_t **table;
+    int capacity;
+    load_table(map, &table, &capacity);
+    unsigned next = __atomic_fetch_add((unsigned*) &map->defragNext, 1, __ATOMIC_RELAXED);
+    moved += defrag_bucket(map, next % capacity, wait);
+  }
+  return moved;
+}
+
+/**
+ * Queues an entry del has just unlinked for the maintenance thread to free,
+ * so the del doesn't pay for it. Called with the entry's stripe lock held.
+ * @return 1 if the entry was queued, 0 if the map has no maintenance thread
+ */
+static int defer_entry(ts_hashmap_t *map, int stripe, ts_entry_t *entry) {
+  // an RCU get may still be walking through the entry, and unlike an
+  // optimistic one it never re-checks, so the entry's next has to stay
+  if (map->maint == NULL || (map->flags & TS_RCU) || (entry->flags & TS_ENTRY_INTRUSIVE)) {
+    return 0;
+  }
+  ts_pending_t *pending = &map->backlog->pending[stripe];
+  // an optimistic get may still be standing on the entry; it'll fail
+  // validation, but the pointer it follows has to stay a valid one
+  __atomic_store_n(&entry->next, pending->head, __ATOMIC_RELAXED);
+  __atomic_store_n(&pending->head, entry, __ATOMIC_RELAXED);
+  __atomic_store_n(&pending->count, pending->count + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+/**
+ * One pass of the maintenance thread: frees the entries dels have queued,
+ * a stripe's worth at a time; allocates and migrates a wanted resize;
+ * un-splits keys that have cooled down; and compacts chains and unlinks
+ * dead entries a few buckets at a time.
+ * @return how much work the pass did
+ */
+static int maintain(void *arg) {
+  ts_hashmap_t *map = (ts_hashmap_t*) arg;
+  ts_backlog_t *backlog = map->backlog;
+  int work = 0;
+  for (int i = 0; i < map->numStripes; i++) {
+    ts_pending_t *pending = &backlog->pending[i];
+    if (__atomic_load_n(&pending->head, __ATOMIC_RELAXED) == NULL) {
+      continue;
+    }
+    // busy stripes keep their entries until the next pass
+    if (lock_try_write(&map->stripes[i].lock) != 0) {
+      continue;
+    }
+    ts_entry_t *entry = pending->head;
+    pending->head = NULL;
+    __atomic_store_n(&pending->count, 0, __ATOMIC_RELAXED);
+    unlock(&map->stripes[i].lock);
+    while (entry != NULL) {
+      ts_entry_t *next = entry->next;
+      if (map->registry != NULL) {
+        registry_charge(map->registry, &map->memory, -(long) sizeof(ts_entry_t));
+      }
+      epoch_retire(entry, entry_free(map));
+      backlog->reclaimed++;
+      work++;
+      entry = next;
+    }
+  }
+  backlog->limbo = epoch_collect();
+  if (map->adapt != NULL) {
+    if (__atomic_exchange_n(&backlog->wantResize, 0, __ATOMIC_RELAXED)) {
+      start_resize(map);
+    }
+    if (__atomic_load_n(&map->adapt->resizing, __ATOMIC_ACQUIRE) == RESIZE_MIGRATING) {
+      int moved = help_resize(map, MAINT_MIGRATE_STEP);
+      backlog->migrated += moved;
+      work += moved;
+    }
+  }
+  int ops = __atomic_load_n(&map->numOps, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&map->hot->count, __ATOMIC_RELAXED) > 0 && ops - backlog->lastCool >= SPLIT_COOL_OPS) {
+    backlog->lastCool = ops;
+    int cooled = cool_splits(map);
+    backlog->cooled += cooled;
+    work += cooled;
+  }
+  if (map->slabs != NULL) {
+    int compacted = defrag(map, MAINT_DEFRAG_STEP, 0);
+    backlog->compacted += compacted;
+    work += compacted;
+  }
+  if (map->flags & TS_LAZY_DEL) {
+    int purged = purge(map, MAINT_PURGE_STEP);
+    backlog->purged += purged;
+    work += purged;
+  }
+  return work;
+}
+
+/**
+ * Looks a key up in an RCU map. Published entries never change, so the
+ * walk is plain loads inside a light epoch section: no lock, no atomic
+ * read-modify-write and no fence (see epoch_enter_light).
+ */
+static int get_rcu(ts_hashmap_t *map, ts_map_handle_t *h, int key, int bucket) {
+  struct epoch_slot_t *slot = h != NULL ? h->slot : epoch_slot();
+  epoch_enter_light(slot);
+  int value = INT_MAX;
+  ts_entry_t *entry = __atomic_load_n(head_of(map, map->table, bucket), __ATOMIC_CONSUME);
+  while (entry != NULL) {
+    if (entry->key == key) {
+      value = entry_dead(entry) ? INT_MAX : entry->value;
+      break;
+    }
+    entry = entry->next;
+  }
+  epoch_exit_slot(slot);
+  return value;
+}
+
+/**
+ * Changes an entry of an RCU map by copying the chain in front of it: the
+ * copies lead to a live copy of target holding the new value (or, to drop
+ * it, straight to whatever follows it), and one store to the bucket head
+ * swaps the whole prefix in. Gets already in the old prefix finish there;
+ * its entries are retired, except a dropped target, which the caller
+ * releases as usual. Called with the stripe lock held.
+ */
+static void rcu_replace(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t **head, ts_entry_t *target, int value, int drop) {
+  ts_entry_t *first = NULL;
+  ts_entry_t **link = &first;
+  ts_entry_t *old = *head;
+  for (ts_entry_t *curr = old; curr != target; curr = curr->next) {
+    ts_entry_t *copy = alloc_entry(map, h, stripe, curr);
+    *copy = *curr;
+    *link = copy;
+    link = &copy->next;
+  }
+  if (drop) {
+    *link = target->next;
+  } else {
+    ts_entry_t *copy = alloc_entry(map, h, stripe, target);
+    *copy = *target;
+    copy->value = value;
+    copy->flags &= ~TS_ENTRY_DEAD;
+    *link = copy;
+  }
+  __atomic_store_n(head, first, __ATOMIC_RELEASE);
+  // point the index at the copies, then let the originals go
+  ts_entry_t *copy = first;
+  while (old != target) {
+    ts_entry_t *next = old->next;
+    if (map->index != NULL) {
+      index_replace(map->index, copy);
+    }
+    release_entry(map, h, old, 0);
+    copy = copy->next;
+    old = next;
+  }
+  if (!drop) {
+    if (map->index != NULL) {
+      index_replace(map->index, copy);
+    }
+    release_entry(map, h, target, 0);
+  }
+}
+
+/**
+ * The body of get() and its variants; h is the calling thread's handle, or
+ * NULL. until bounds the wait for the stripe lock (see lock_stripe_until).
+ * @param result where to store what get() returns
+ * @return 0, or ETIMEDOUT if the lock couldn't be had in time
+ */
+static int get_with(ts_hashmap_t *map, ts_map_handle_t *h, int key, const struct timespec *until, int *result) {
+  // increment the number of operations performed:
+  count_op(map, h, 1, until == NULL);
+  if (map->cache != NULL) {
+    cache_touch(map->cache, key);
+  }
+  int bucket = bucket_of(map, key);
+  int value = INT_MAX;
+  int chain = 0;
+  int retried = 0;
+  if (map->flags & TS_RCU) {
+    *result = get_rcu(map, h, key, bucket);
+    return 0;
+  }
+  // a read-heavy adaptive map skips the lock when it can
+  if (map->adapt != NULL && __atomic_load_n(&map->adapt->optimistic, __ATOMIC_RELAXED)) {
+    if (get_optimistic(map, h, key, bucket, &value, &chain)) {
+      tally_op(map, h, 0, 0, 0, chain, until == NULL);
+      *result = value;
+      return 0;
+    }
+    retried = 1;
+  }
+  int stripe = stripe_of(map, bucket);
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  int contended = lock_stripe_until(map, lock, 0, until);
+  if (contended < 0) {
+    tally_op(map, h, 0, 1, retried, 0, 0);
+    return ETIMEDOUT;
+  }
+  // get the head of the bucket that we think the entry is in:
+  ts_entry_t *currEntry = *chain_of(map, key);
+  // iterate through the bucket until we find an entry with a matching key, or reach the end of the bucket
+  while (currEntry != NULL) {
+    chain++;
+    // return the corresponding value if we find it (and it isn't deleted)
+    if (currEntry->key == key) {
+      if (!entry_dead(currEntry)) {
+        value = entry_value(currEntry);
+      }
+      break;
+    }
+    // get the next entry in the bucket
+    currEntry = currEntry->next;
+  }
+  unlock(lock);
+  tally_op(map, h, 0, contended, retried, chain, until == NULL);
+  // INT_MAX if we couldn't find any entries with a matching key
+  *result = value;
+  return 0;
+}
+
+/**
+ * Obtains the value associated with the given key.
+ * @param map a pointer to the map
+ * @param key a key to search
+ * @return the value associated with the given key, or INT_MAX if key not found
+ */
+int get(ts_hashmap_t *map, int key) {
+  int result;
+  get_with(map, NULL, key, NULL, &result);
+  return result;
+}
+
+/**
+ * Whether a map in a registry can't take another entry. Checked before a
+ * new key goes in; copies of existing entries aren't held to it.
+ */
+static int over_budget(ts_hashmap_t *map) {
+  return map->registry != NULL && registry_full(map->registry, sizeof(ts_entry_t));
+}
+
+/**
+ * Links a filled-in entry in at the head of a chain. Called with the
+ * stripe lock held, once its key is known not to be in the chain.
+ */
+static void link_entry(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t **head, ts_entry_t *new_bucket_head) {
+  // set the next value as the old head:
+  new_bucket_head->next = *head;
+  // make the table point to this entry as the head:
+  write_begin(map, &map->stripes[stripe]);
+  __atomic_store_n(head, new_bucket_head, __ATOMIC_RELEASE);
+  write_end(map, &map->stripes[stripe]);
+  __atomic_fetch_add(&map->size, 1, __ATOMIC_RELAXED);
+  // the callers' own nodes are never evicted
+  if (map->cache != NULL && !(new_bucket_head->flags & TS_ENTRY_INTRUSIVE)) {
+    cache_insert(map->cache, new_bucket_head->key);
+  }
+  if (map->index != NULL) {
+    index_insert(map->index, new_bucket_head, h != NULL ? &h->seed : NULL);
+  }
+  if (map->stream != NULL) {
+    stream_append(map->stream, stripe, TS_CHANGE_PUT, new_bucket_head->key, new_bucket_head->value);
+  }
+}
+
+/**
+ * Adds a new entry at the head of a chain. Called with the stripe lock
+ * held, once the key is known not to be in the chain.
+ */
+static void insert_entry(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t **head, int key, int value) {
+  // make a new entry for the new head of this bucket:
+  ts_entry_t *new_bucket_head = alloc_entry(map, h, stripe, *head);
+  // fill the entry
+  new_bucket_head->key = key;
+  new_bucket_head->value = value;
+  new_bucket_head->flags = 0;
+  new_bucket_head->split = NULL;
+  link_entry(map, h, stripe, head, new_bucket_head);
+}
+
+/**
+ * Adds a key to a TS_LAZY_DEL chain that doesn't hold it live, reusing a
+ * dead entry instead of allocating one where it can: the key's own, which
+ * comes back to life, or, on a map whose gets all take the lock, any
+ * other. Unlinks the chain's dead entries if too many are left. Called
+ * with the stripe lock held.
+ */
+static void insert_lazy(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t **head, int key, int value) {
+  ts_entry_t *same = NULL;
+  ts_entry_t *spare = NULL;
+  int dead = 0;
+  for (ts_entry_t *entry = *head; entry != NULL; entry = entry->next) {
+    if (entry->flags & TS_ENTRY_DEAD) {
+      dead++;
+      if (entry->key == key) {
+        same = entry;
+      } else if (spare == NULL && !(entry->flags & TS_ENTRY_INTRUSIVE)) {
+        spare = entry;
+      }
+    }
+  }
+  // a reader without the lock could read a recycled entry's old key and
+  // then its new value, so only a locked-reads map recycles across keys
+  if (same == NULL && map->index == NULL && map->adapt == NULL && !(map->flags & TS_RCU)) {
+    same = spare;
+  }
+  if (same == NULL) {
+    insert_entry(map, h, stripe, head, key, value);
+  } else {
+    dead--;
+    if (map->flags & TS_RCU) {
+      rcu_replace(map, h, stripe, head, same, value, 0);
+    } else {
+      __atomic_store_n(&same->key, key, __ATOMIC_RELAXED);
+      __atomic_store_n(&same->value, value, __ATOMIC_RELAXED);
+      __atomic_store_n(&same->flags, same->flags & ~TS_ENTRY_DEAD, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_add(&map->size, 1, __ATOMIC_RELAXED);
+    if (map->cache != NULL) {
+      cache_insert(map->cache, key);
+    }
+    if (map->stream != NULL) {
+      stream_append(map->stream, stripe, TS_CHANGE_PUT, key, value);
+    }
+  }
+  if (dead >= LAZY_PURGE_AT) {
+    purge_chain(map, h, stripe, head);
+  }
+}
+
+/**
+ * Deletes the keys a TS_CACHE map's policy has picked to make room. Called
+ * by the insert that made them go, once it's let go of its stripe lock: a
+ * victim can be in any stripe, and its unlink waits for that stripe's lock
+ * even when the put was a try_put or put_until. Until then the map is a
+ * key over maxEntries, so the bound is soft. Victims are unlinked without
+ * counting an operation, since the caller didn't issue one.
+ */
+static void evict(ts_hashmap_t *map, ts_map_handle_t *h) {
+  int key;
+  int old;
+  int contended;
+  while (cache_victim(map->cache, &key)) {
+    unlink_key(map, h, key, NULL, &contended, &old);
+  }
 }
 
 /**
- * Obtains the value associated with the given key.
- * @param map a pointer to the map
- * @param key a key to search
- * @return the value associated with the given key, or INT_MAX if key not found
+ * The body of put() and its variants; h is the calling thread's handle, or
+ * NULL. until bounds the wait for the stripe lock (see lock_stripe_until).
+ * @param result where to store what put() returns
+ * @return 0, ETIMEDOUT if the lock couldn't be had in time, or ENOMEM if
+ * the key is new and the map's registry is out of budget
  */
-int get(ts_hashmap_t *map, int key) {
+static int put_with(ts_hashmap_t *map, ts_map_handle_t *h, int key, int value, const struct timespec *until, int *result) {
   // increment the number of operations performed:
-  (map->numOps)++;
+  count_op(map, h, 1, until == NULL);
+  if (map->cache != NULL) {
+    cache_touch(map->cache, key);
+  }
+  int bucket = bucket_of(map, key);
+  int stripe = stripe_of(map, bucket);
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  int contended = lock_stripe_until(map, lock, 1, until);
+  if (contended < 0) {
+    tally_op(map, h, 1, 1, 0, 0, 0);
+    return ETIMEDOUT;
+  }
   // get the head of the bucket that we think the entry is in:
-  ts_entry_t *currEntry = (map->table)[key % (map->capacity)];
+  ts_entry_t **head = chain_of(map, key);
+  ts_entry_t *currEntry = *head;
   // iterate through the bucket until we find an entry with a matching key, or reach the end of the bucket
   while (currEntry != NULL) {
     // return the corresponding value if we find it
-    if (currEntry->key == key) {
-      return currEntry->value;
+    if (currEntry->key == key && !(currEntry->flags & TS_ENTRY_DEAD)) {
+      int temp = entry_value(currEntry);
+      if (map->flags & TS_RCU) {
+        rcu_replace(map, h, stripe, head, currEntry, value, 0);
+      } else {
+        // a split key's slots keep counting, so the base absorbs their sum
+        int base = value;
+        if (currEntry->split != NULL) {
+          base = (int) (value - split_sum(currEntry->split));
+        }
+        // range scans and optimistic gets read values without the lock
+        __atomic_store_n(&currEntry->value, base, __ATOMIC_RELAXED);
+      }
+      if (map->stream != NULL) {
+        stream_append(map->stream, stripe, TS_CHANGE_PUT, key, value);
+      }
+      unlock(lock);
+      tally_op(map, h, 1, contended, 0, 0, until == NULL);
+      *result = temp;
+      return 0;
     }
     // get the next entry in the bucket
     currEntry = currEntry->next;
   }
-  // we couldn't find any entries with a matching key. return INT_MAX
-  return INT_MAX;
+  *result = INT_MAX;
+  if (over_budget(map)) {
+    unlock(lock);
+    tally_op(map, h, 1, contended, 0, 0, until == NULL);
+    return ENOMEM;
+  }
+  if (map->flags & TS_LAZY_DEL) {
+    insert_lazy(map, h, stripe, head, key, value);
+  } else {
+    insert_entry(map, h, stripe, head, key, value);
+  }
+  unlock(lock);
+  tally_op(map, h, 1, contended, 0, 0, until == NULL);
+  if (map->cache != NULL) {
+    evict(map, h);
+  }
+  return 0;
 }
 
 /**
- * Associates a value associated with a given key.
+ * Associates a value associated with a given key. On a map whose registry
+ * has used up its memory budget, a new key isn't stored: put returns
+ * INT_MAX and sets errno to ENOMEM. On a full TS_CACHE map, a new key
+ * makes another key go (see ts_cache.h).
  * @param map a pointer to the map
  * @param key a key
  * @param value a value
  * @return old associated value, or INT_MAX if the key was new
  */
 int put(ts_hashmap_t *map, int key, int value) {
-  // increment the number of operations performed:
-  (map->numOps)++;  
-  // get the head of the bucket that we think the entry is in:
-  ts_entry_t *currEntry = (map->table)[key % (map->capacity)];
-  // iterate through the bucket until we find an entry with a matching key, or reach the end of the bucket
-  while (currEntry != NULL) {
-    // return the corresponding value if we find it
-    if (currEntry->key == key) {
-      int temp = currEntry->value;
-      currEntry->value = value;
-      return temp;
+  int result;
+  if (put_with(map, NULL, key, value, NULL, &result) != 0) {
+    errno = ENOMEM;
+  }
+  return result;
+}
+
+/**
+ * Deletes a key from a TS_LAZY_DEL chain with a single store that marks its
+ * entry dead, then unlinks the chain's dead entries if there are too many.
+ * Called with the stripe lock held.
+ * @param result where to store what del() returns
+ * @return 1 if done, 0 if the key is split or held by an intrusive node and
+ * has to be unlinked now
+ */
+static int del_lazy(ts_hashmap_t *map, ts_map_handle_t *h, int stripe, ts_entry_t **head, int key, int *result) {
+  ts_entry_t *target = NULL;
+  int dead = 0;
+  for (ts_entry_t *entry = *head; entry != NULL; entry = entry->next) {
+    if (entry->flags & TS_ENTRY_DEAD) {
+      dead++;
+    } else if (entry->key == key) {
+      target = entry;
     }
-    // get the next entry in the bucket
-    currEntry = currEntry->next;
   }
-  ts_entry_t *old_bucket_head = (map->table)[key % (map->capacity)];
-  // make a new entry for the new head of this bucket:
-  ts_entry_t *new_bucket_head = malloc(sizeof(ts_entry_t));
-  // fill the entry
-  new_bucket_head->key = key;
-  new_bucket_head->value = value;
-  // set the next value as the old head:
-  new_bucket_head->next = old_bucket_head;
-  // make the table point to this entry as the head:
-  (map->table)[key % (map->capacity)] = new_bucket_head;
-  return INT_MAX;
+  if (target != NULL && (target->split != NULL || (target->flags & TS_ENTRY_INTRUSIVE))) {
+    return 0;
+  }
+  *result = INT_MAX;
+  if (target != NULL) {
+    *result = target->value;
+    __atomic_store_n(&target->flags, target->flags | TS_ENTRY_DEAD, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&map->size, 1, __ATOMIC_RELAXED);
+    if (map->cache != NULL) {
+      cache_remove(map->cache, key);
+    }
+    if (map->stream != NULL) {
+      stream_append(map->stream, stripe, TS_CHANGE_DEL, key, *result);
+    }
+    dead++;
+  }
+  if (dead >= LAZY_PURGE_AT) {
+    purge_chain(map, h, stripe, head);
+  }
+  return 1;
 }
 
 /**
- * Removes an entry in the map
- * @param map a pointer to the map
- * @param key a key to search
- * @return the value associated with the given key, or INT_MAX if key not found
+ * Unlinks a key without counting it as an operation: the body of del()
+ * and its variants, and how a TS_CACHE map drops its victims. h is the
+ * calling thread's handle, or NULL. until bounds the wait for the stripe
+ * lock (see lock_stripe_until).
+ * @param contended where to store whether the stripe lock had to be waited for
+ * @param result where to store what del() returns
+ * @return 0, or ETIMEDOUT if the lock couldn't be had in time
  */
-int del(ts_hashmap_t *map, int key) {
-  // increment the number of operations performed:
-  (map->numOps)++;
+static int unlink_key(ts_hashmap_t *map, ts_map_handle_t *h, int key, const struct timespec *until, int *contended, int *result) {
+  int bucket = bucket_of(map, key);
+  int stripe = stripe_of(map, bucket);
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  *contended = lock_stripe_until(map, lock, 1, until);
+  if (*contended < 0) {
+    return ETIMEDOUT;
+  }
   // get the head of the bucket that we think the entry is in:
-  ts_entry_t *currEntry = (map->table)[key % (map->capacity)];
+  ts_entry_t **head = chain_of(map, key);
+  // a lazy del only marks the entry; a split key still has to be folded
+  // back, though, and an intrusive node handed back to its owner, so
+  // those are unlinked right away like on any other map
+  if (map->flags & TS_LAZY_DEL) {
+    int deleted = del_lazy(map, h, stripe, head, key, result);
+    if (deleted) {
+      unlock(lock);
+      return 0;
+    }
+  }
+  ts_entry_t *currEntry = *head;
   // If the bucket is empty, we don't have to do anything. Just return inf
   if (currEntry == NULL) {
-    return INT_MAX;
+    unlock(lock);
+    *result = INT_MAX;
+    return 0;
   }
-  // if there is only one entry in the bucket and it's the one that we want to delete, just delete it and we're done
-  if (currEntry->next == NULL && currEntry->key == key) {
+  // if the head is the one that we want to delete, just unlink it and we're done
+  if (currEntry->key == key) {
     int temp = currEntry->value;
-    free(currEntry);
-    currEntry = NULL;
-    (map->table)[key % (map->capacity)] = NULL;
-    return temp;
+    int wasSplit = currEntry->split != NULL;
+    if (map->index != NULL) {
+      index_remove(map->index, key);
+    }
+    write_begin(map, &map->stripes[stripe]);
+    if (wasSplit) {
+      temp = (int) (temp + unsplit_entry(map, currEntry));
+    }
+    __atomic_store_n(head, currEntry->next, __ATOMIC_RELAXED);
+    write_end(map, &map->stripes[stripe]);
+    __atomic_fetch_sub(&map->size, 1, __ATOMIC_RELAXED);
+    if (map->cache != NULL) {
+      cache_remove(map->cache, key);
+    }
+    if (map->stream != NULL) {
+      stream_append(map->stream, stripe, TS_CHANGE_DEL, key, temp);
+    }
+    int deferred = defer_entry(map, stripe, currEntry);
+    unlock(lock);
+    if (!deferred) {
+      release_entry(map, h, currEntry, wasSplit);
+    }
+    *result = temp;
+    return 0;
   }
   // if there is only one entry in the bucket and it's not the one we want, just return inf
-  if (currEntry->next == NULL && currEntry->key != key) {
-    return INT_MAX;
+  if (currEntry->next == NULL) {
+    unlock(lock);
+    *result = INT_MAX;
+    return 0;
   }
   // so, now we know that there are at least two entries in our bucket and the first one isn't the one that we are trying to delete:
   ts_entry_t *prevEntry = currEntry;
@@ -116,20 +1800,663 @@ int del(ts_hashmap_t *map, int key) {
     // return the corresponding value if we find it and delete its entry:
     if (currEntry->key == key) {
       int temp = currEntry->value;
+      int wasSplit = currEntry->split != NULL;
+      if (map->index != NULL) {
+        index_remove(map->index, key);
+      }
       // cut currEntry entry out of the bucket
-      prevEntry->next = currEntry->next;
-      free(currEntry);
-      currEntry = NULL;
-      return temp;
+      write_begin(map, &map->stripes[stripe]);
+      if (wasSplit) {
+        temp = (int) (temp + unsplit_entry(map, currEntry));
+      }
+      if (map->flags & TS_RCU) {
+        rcu_replace(map, h, stripe, head, currEntry, 0, 1);
+      } else {
+        __atomic_store_n(&prevEntry->next, currEntry->next, __ATOMIC_RELAXED);
+      }
+      write_end(map, &map->stripes[stripe]);
+      __atomic_fetch_sub(&map->size, 1, __ATOMIC_RELAXED);
+      if (map->cache != NULL) {
+        cache_remove(map->cache, key);
+      }
+      if (map->stream != NULL) {
+        stream_append(map->stream, stripe, TS_CHANGE_DEL, key, temp);
+      }
+      int deferred = defer_entry(map, stripe, currEntry);
+      unlock(lock);
+      if (!deferred) {
+        release_entry(map, h, currEntry, wasSplit);
+      }
+      *result = temp;
+      return 0;
     }
     // get the next entry in the bucket
     prevEntry = currEntry;
     currEntry = currEntry->next;
   }
+  unlock(lock);
   // if we couldn't find any entries with the target key, then return inf:
-  return INT_MAX;
+  *result = INT_MAX;
+  return 0;
+}
+
+/**
+ * The body of del() and its variants; h is the calling thread's handle, or
+ * NULL. until bounds the wait for the stripe lock (see lock_stripe_until).
+ * @param result where to store what del() returns
+ * @return 0, or ETIMEDOUT if the lock couldn't be had in time
+ */
+static int del_with(ts_hashmap_t *map, ts_map_handle_t *h, int key, const struct timespec *until, int *result) {
+  // increment the number of operations performed:
+  count_op(map, h, 1, until == NULL);
+  int contended;
+  if (unlink_key(map, h, key, until, &contended, result) != 0) {
+    tally_op(map, h, 1, 1, 0, 0, 0);
+    return ETIMEDOUT;
+  }
+  tally_op(map, h, 1, contended, 0, 0, until == NULL);
+  return 0;
+}
+
+/**
+ * Removes an entry in the map
+ * @param map a pointer to the map
+ * @param key a key to search
+ * @return the value associated with the given key, or INT_MAX if key not found
+ */
+int del(ts_hashmap_t *map, int key) {
+  int result;
+  del_with(map, NULL, key, NULL, &result);
+  return result;
+}
+
+/**
+ * Adds to a key's value under its stripe lock, creating the key with the
+ * delta as its value if it isn't there.
+ */
+static int add_locked(ts_hashmap_t *map, ts_map_handle_t *h, int key, int delta) {
+  int bucket = bucket_of(map, key);
+  int stripe = stripe_of(map, bucket);
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  int contended = lock_stripe(map, lock, 1);
+  ts_entry_t **head = chain_of(map, key);
+  ts_entry_t *currEntry = *head;
+  while (currEntry != NULL && currEntry->key != key) {
+    currEntry = currEntry->next;
+  }
+  int old = INT_MAX;
+  if (currEntry != NULL && !(currEntry->flags & TS_ENTRY_DEAD)) {
+    old = entry_value(currEntry);
+    // a split key that got here anyway (its split is closing, or the map
+    // is out of splits) adds to the base like any other key
+    if (map->flags & TS_RCU) {
+      rcu_replace(map, h, stripe, head, currEntry, (int) ((unsigned) old + delta), 0);
+    } else {
+      __atomic_store_n(&currEntry->value, (int) ((unsigned) currEntry->value + delta), __ATOMIC_RELAXED);
+    }
+    if (map->stream != NULL) {
+      stream_append(map->stream, stripe, TS_CHANGE_PUT, key, (int) ((unsigned) old + delta));
+    }
+    note_add(map, &map->stripes[stripe], currEntry, contended);
+  } else if (over_budget(map)) {
+    errno = ENOMEM;
+  } else if (map->flags & TS_LAZY_DEL) {
+    insert_lazy(map, h, stripe, head, key, delta);
+  } else {
+    insert_entry(map, h, stripe, head, key, delta);
+  }
+  unlock(lock);
+  tally_op(map, h, 1, contended, 0, 0, 1);
+  if (map->cache != NULL) {
+    evict(map, h);
+  }
+  return old;
+}
+
+/**
+ * Adds to a split key's value through this CPU's slot, without the lock.
+ * @param old where to store a recent value of the key
+ * @return 1 if the key is split, 0 if the caller has to take the lock
+ */
+static int add_split(ts_hashmap_t *map, ts_map_handle_t *h, int key, int delta, int *old) {
+  ts_hotkeys_t *hot = map->hot;
+  int found = 0;
+  enter(h);
+  for (int i = 0; i < SPLIT_MAX_KEYS && !found; i++) {
+    ts_split_t *split = __atomic_load_n(&hot->splits[i], __ATOMIC_ACQUIRE);
+    if (split == NULL || split->key != key) {
+      continue;
+    }
+    found = 1;
+    int slot = split_add(split, delta);
+    // read the entry before checking closed: once the split has closed,
+    // a del may free the entry at any time
+    int value = (int) (__atomic_load_n(&split->entry->value, __ATOMIC_RELAXED) + split_sum(split));
+    *old = (int) ((unsigned) value - delta);
+    if (__atomic_load_n(&split->closed, __ATOMIC_SEQ_CST)) {
+      // the split is being folded back; take back whatever the fold
+      // hasn't collected from our slot yet and apply it the slow way
+      long late = split_take(split, slot);
+      leave(h);
+      if (late != 0) {
+        add_locked(map, h, key, (int) late);
+      }
+      return 1;
+    }
+  }
+  leave(h);
+  return found;
+}
+
+/**
+ * The body of fetch_add() and hfetch_add(); h is the calling thread's handle, or NULL.
+ */
+static int fetch_add_with(ts_hashmap_t *map, ts_map_handle_t *h, int key, int delta) {
+  // increment the number of operations performed:
+  count_op(map, h, 1, 1);
+  if (map->cache != NULL) {
+    cache_touch(map->cache, key);
+  }
+  int old;
+  if (__atomic_load_n(&map->hot->count, __ATOMIC_RELAXED) > 0 && add_split(map, h, key, delta, &old)) {
+    return old;
+  }
+  return add_locked(map, h, key, delta);
+}
+
+/**
+ * Adds to the value associated with a given key, creating the key with
+ * delta as its value if it isn't there. A key whose adds keep waiting on
+ * its stripe lock is split into per-core sub-values (except on TS_RCU and
+ * TS_STREAM maps, where every add has to go through the lock), after which
+ * adds don't take the lock at all; while it's split, adds from different cores
+ * aren't ordered with each other, so the value returned is the key's value
+ * around the time of the call rather than exactly the one it replaced.
+ * Like put(), it doesn't create a key once the map's registry is out of
+ * budget, and sets errno to ENOMEM instead.
+ * @param map a pointer to the map
+ * @param key a key
+ * @param delta the amount to add
+ * @return old associated value, or INT_MAX if the key was new
+ */
+int fetch_add(ts_hashmap_t *map, int key, int delta) {
+  return fetch_add_with(map, NULL, key, delta);
+}
+
+/**
+ * Like get(), but fails instead of waiting when the key's stripe is busy.
+ * @param map a pointer to the map
+ * @param key a key to search
+ * @param value where to store the value, or INT_MAX if key not found
+ * @return 0 on success, or EBUSY if the stripe was locked
+ */
+int try_get(ts_hashmap_t *map, int key, int *value) {
+  return get_with(map, NULL, key, &noWait, value) ? EBUSY : 0;
+}
+
+/**
+ * Like put(), but fails instead of waiting when the key's stripe is busy.
+ * @param old where to store the old value, or INT_MAX if the key was new
+ * @return 0 on success, EBUSY if the stripe was locked, or ENOMEM if the
+ * key is new and the map's registry is out of budget
+ */
+int try_put(ts_hashmap_t *map, int key, int value, int *old) {
+  int err = put_with(map, NULL, key, value, &noWait, old);
+  return err == ETIMEDOUT ? EBUSY : err;
+}
+
+/**
+ * Like del(), but fails instead of waiting when the key's stripe is busy.
+ * @param old where to store the deleted value, or INT_MAX if not found
+ * @return 0 on success, or EBUSY if the stripe was locked
+ */
+int try_del(ts_hashmap_t *map, int key, int *old) {
+  return del_with(map, NULL, key, &noWait, old) ? EBUSY : 0;
+}
+
+/**
+ * Like get(), but waits for the key's stripe only until a deadline: it
+ * spins on the lock briefly, then parks on it until the deadline passes.
+ * @param map a pointer to the map
+ * @param key a key to search
+ * @param deadline an absolute CLOCK_REALTIME time, as for pthread_mutex_timedlock
+ * @param value where to store the value, or INT_MAX if key not found
+ * @return 0 on success, or ETIMEDOUT if the deadline passed first
+ */
+int get_until(ts_hashmap_t *map, int key, const struct timespec *deadline, int *value) {
+  return get_with(map, NULL, key, deadline, value);
+}
+
+/**
+ * Like put(), but waits for the key's stripe only until a deadline.
+ * @param old where to store the old value, or INT_MAX if the key was new
+ * @return 0 on success, ETIMEDOUT if the deadline passed first, or ENOMEM
+ * if the key is new and the map's registry is out of budget
+ */
+int put_until(ts_hashmap_t *map, int key, int value, const struct timespec *deadline, int *old) {
+  return put_with(map, NULL, key, value, deadline, old);
+}
+
+/**
+ * Like del(), but waits for the key's stripe only until a deadline.
+ * @param old where to store the deleted value, or INT_MAX if not found
+ * @return 0 on success, or ETIMEDOUT if the deadline passed first
+ */
+int del_until(ts_hashmap_t *map, int key, const struct timespec *deadline, int *old) {
+  return del_with(map, NULL, key, deadline, old);
+}
+
+/**
+ * Creates the calling thread's handle for a map. Operations through the
+ * handle skip the per-call lookups of thread-local state: the thread's
+ * share of the operation count is added to numOps in batches, entries the
+ * thread deletes are reused for its inserts where nothing else can still
+ * see them, and its epoch slot and random seed are kept at hand. A handle
+ * belongs to the thread that registered it; release it with
+ * map_unregister_thread before the thread exits or the map is freed.
+ * @param map a pointer to the map
+ * @return a pointer to a new handle
+ */
+ts_map_handle_t *map_register_thread(ts_hashmap_t *map) {
+  ts_map_handle_t *h = (ts_map_handle_t*) calloc(1, sizeof(ts_map_handle_t));
+  h->map = map;
+  h->slot = epoch_slot();
+  h->seed = (unsigned) (uintptr_t) h | 1;
+  return h;
+}
+
+/**
+ * Releases a handle, adding in what it had counted and freeing its cache.
+ * @param h a handle from map_register_thread
+ */
+void map_unregister_thread(ts_map_handle_t *h) {
+  __atomic_fetch_add(&h->map->numOps, h->ops, __ATOMIC_RELAXED);
+  // the adaptive counts since the handle's last flush go to the map too
+  if (h->map->adapt != NULL && h->tally.map == h->map && h->tally.reads + h->tally.writes > 0) {
+    flush_tally(h->map, &h->tally);
+  }
+  for (int i = 0; i < h->cached; i++) {
+    free(h->cache[i]);
+  }
+  free(h);
+}
+
+/**
+ * get(), put(), del() and fetch_add() through the calling thread's handle.
+ */
+int hget(ts_map_handle_t *h, int key) {
+  int result;
+  get_with(h->map, h, key, NULL, &result);
+  return result;
+}
+
+int hput(ts_map_handle_t *h, int key, int value) {
+  int result;
+  if (put_with(h->map, h, key, value, NULL, &result) != 0) {
+    errno = ENOMEM;
+  }
+  return result;
+}
+
+int hdel(ts_map_handle_t *h, int key) {
+  int result;
+  del_with(h->map, h, key, NULL, &result);
+  return result;
+}
+
+int hfetch_add(ts_map_handle_t *h, int key, int delta) {
+  return fetch_add_with(h->map, h, key, delta);
+}
+
+/**
+ * Looks up a chunk of keys whose buckets are already known. Instead of
+ * walking one chain to the end before starting the next, it keeps BATCH_GROUP lookups in flight and
+ * advances them round-robin, one node each: every step prefetches the
+ * node a lookup needs next and moves on, so by the time it comes back
+ * around the node is in cache and the misses of the whole group overlap.
+ * Stripe locks are only ever tried, never waited for while holding
+ * another, so two batches can't deadlock.
+ */
+static void get_chunk(ts_hashmap_t *map, const int *keys, const int *buckets, int *values, int n) {
+  batch_slot_t group[BATCH_GROUP];
+  int inFlight = 0;
+  int next = 0;
+  // start the first group off by prefetching their bucket heads
+  while (inFlight < BATCH_GROUP && next < n) {
+    batch_slot_t *slot = &group[inFlight++];
+    slot->index = next++;
+    slot->bucket = buckets[slot->index];
+    slot->stripe = stripe_of(map, slot->bucket);
+    slot->locked = 0;
+    __builtin_prefetch(head_of(map, map->table, slot->bucket));
+  }
+  while (inFlight > 0) {
+    for (int i = 0; i < inFlight; i++) {
+      batch_slot_t *slot = &group[i];
+      int key = keys[slot->index];
+      int done = 0;
+      if (!slot->locked) {
+        // someone else has the stripe; try again next time around
+        if (lock_try_read(&map->stripes[slot->stripe].lock) != 0) {
+          continue;
+        }
+        slot->locked = 1;
+        // an adaptive map may have grown since the chunk was hashed
+        slot->entry = map->adapt != NULL ? *chain_of(map, key) : *head_of(map, map->table, slot->bucket);
+        if (slot->entry == NULL) {
+          values[slot->index] = INT_MAX;
+          done = 1;
+        } else {
+          __builtin_prefetch(slot->entry);
+        }
+      } else if (slot->entry->key == key) {
+        values[slot->index] = entry_dead(slot->entry) ? INT_MAX : entry_value(slot->entry);
+        done = 1;
+      } else {
+        // step one node down the chain and prefetch it for the next round
+        slot->entry = slot->entry->next;
+        if (slot->entry == NULL) {
+          values[slot->index] = INT_MAX;
+          done = 1;
+        } else {
+          __builtin_prefetch(slot->entry);
+        }
+      }
+      if (!done) {
+        continue;
+      }
+      unlock(&map->stripes[slot->stripe].lock);
+      // refill the slot with the next key, or retire it
+      if (next < n) {
+        slot->index = next++;
+        slot->bucket = buckets[slot->index];
+        slot->stripe = stripe_of(map, slot->bucket);
+        slot->locked = 0;
+        __builtin_prefetch(head_of(map, map->table, slot->bucket));
+      } else {
+        group[i--] = group[--inFlight];
+      }
+    }
+  }
+}
+
+/**
+ * Looks up many keys at once, a chunk at a time; see get_chunk.
+ * @param map a pointer to the map
+ * @param keys the keys to search
+ * @param values where to store each key's value (INT_MAX if not found)
+ * @param n the number of keys
+ */
+void get_batch(ts_hashmap_t *map, const int *keys, int *values, int n) {
+  int buckets[BATCH_CHUNK];
+  count_op(map, NULL, n, 1);
+  if (map->cache != NULL) {
+    for (int i = 0; i < n; i++) {
+      cache_touch(map->cache, keys[i]);
+    }
+  }
+  for (int start = 0; start < n; start += BATCH_CHUNK) {
+    int len = n - start < BATCH_CHUNK ? n - start : BATCH_CHUNK;
+    // hash the whole chunk with the vector kernel up front
+    bucket_batch(map, keys + start, buckets, len);
+    get_chunk(map, keys + start, buckets, values + start, len);
+  }
+}
+
+/**
+ * Stores many key/value pairs at once. The bucket heads for a group of
+ * keys are prefetched together before any of the puts run, so their cache
+ * misses overlap instead of being paid one after another.
+ * @param map a pointer to the map
+ * @param keys the keys to store
+ * @param values the value for each key
+ * @param old where to store each key's previous value (may be NULL)
+ * @param n the number of pairs
+ */
+void put_batch(ts_hashmap_t *map, const int *keys, const int *values, int *old, int n) {
+  for (int start = 0; start < n; start += BATCH_GROUP) {
+    int end = start + BATCH_GROUP < n ? start + BATCH_GROUP : n;
+    ts_entry_t **table;
+    int capacity;
+    // an adaptive map can retire its table while we're looking at it
+    if (map->adapt != NULL) {
+      epoch_enter();
+    }
+    load_table(map, &table, &capacity);
+    for (int i = start; i < end; i++) {
+      __builtin_prefetch(head_of(map, table, bucket_in(map, keys[i], capacity)));
+    }
+    // the head pointers are in cache now; prefetch the nodes they point to
+    for (int i = start; i < end; i++) {
+      __builtin_prefetch(__atomic_load_n(head_of(map, table, bucket_in(map, keys[i], capacity)), __ATOMIC_RELAXED));
+    }
+    if (map->adapt != NULL) {
+      epoch_exit();
+    }
+    for (int i = start; i < end; i++) {
+      int prev = put(map, keys[i], values[i]);
+      if (old != NULL) {
+        old[i] = prev;
+      }
+    }
+  }
+}
+
+/**
+ * Links in a node the caller owns, usually embedded in one of its own
+ * objects (see ts_node_owner), instead of one put() would allocate. The
+ * map uses the node as it is until it's removed: nothing is allocated or
+ * copied, and the map never frees it; the caller mustn't change it while
+ * it's linked in. put(), get() and fetch_add() work on its key as on any
+ * other; del() unlinks it but leaves it to its owner.
+ * An RCU map copies the entries it changes, so it can't take nodes.
+ * @param map a pointer to the map
+ * @param node the node, with key and value filled in
+ * @return 0 if the node was linked in, EEXIST if its key is already in the
+ * map, or EINVAL if the map is TS_RCU
+ */
+int insert_node(ts_hashmap_t *map, ts_entry_t *node) {
+  if (map->flags & TS_RCU) {
+    return EINVAL;
+  }
+  count_op(map, NULL, 1, 1);
+  int stripe = stripe_of(map, bucket_of(map, node->key));
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  int contended = lock_stripe(map, lock, 1);
+  ts_entry_t **head = chain_of(map, node->key);
+  // a dead entry of the same key would shadow the node
+  if (map->flags & TS_LAZY_DEL) {
+    purge_chain(map, NULL, stripe, head);
+  }
+  int result = 0;
+  for (ts_entry_t *entry = *head; entry != NULL && result == 0; entry = entry->next) {
+    if (entry->key == node->key) {
+      result = EEXIST;
+    }
+  }
+  if (result == 0) {
+    node->flags = TS_ENTRY_INTRUSIVE;
+    node->split = NULL;
+    link_entry(map, NULL, stripe, head, node);
+  }
+  unlock(lock);
+  tally_op(map, NULL, 1, contended, 0, 0, 1);
+  return result;
 }
 
+/**
+ * Unlinks a node that insert_node linked in. Gets that don't take the lock
+ * (on an indexed or adaptive map, or a split key) may still be reading it
+ * for a while, so done is called once none can be: right away on a map
+ * where every read takes the lock, otherwise after an epoch grace period.
+ * The node's value is final by then.
+ * @param map a pointer to the map
+ * @param node the node
+ * @param done called with the node once its owner may reuse it (may be NULL)
+ * @return 0 if the node was unlinked, or ENOENT if it isn't in the map
+ */
+int remove_node(ts_hashmap_t *map, ts_entry_t *node, void (*done)(void*)) {
+  count_op(map, NULL, 1, 1);
+  int stripe = stripe_of(map, bucket_of(map, node->key));
+  ts_lock_t *lock = &map->stripes[stripe].lock;
+  int contended = lock_stripe(map, lock, 1);
+  ts_entry_t **link = chain_of(map, node->key);
+  while (*link != NULL && *link != node) {
+    link = &(*link)->next;
+  }
+  if (*link == NULL) {
+    unlock(lock);
+    tally_op(map, NULL, 1, contended, 0, 0, 1);
+    return ENOENT;
+  }
+  int wasSplit = node->split != NULL;
+  if (map->index != NULL) {
+    index_remove(map->index, node->key);
+  }
+  write_begin(map, &map->stripes[stripe]);
+  if (wasSplit) {
+    __atomic_store_n(&node->value, (int) (node->value + unsplit_entry(map, node)), __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(link, node->next, __ATOMIC_RELAXED);
+  write_end(map, &map->stripes[stripe]);
+  __atomic_fetch_sub(&map->size, 1, __ATOMIC_RELAXED);
+  if (map->stream != NULL) {
+    stream_append(map->stream, stripe, TS_CHANGE_DEL, node->key, node->value);
+  }
+  unlock(lock);
+  tally_op(map, NULL, 1, contended, 0, 0, 1);
+  if (done != NULL) {
+    if (map->index != NULL || map->adapt != NULL || wasSplit) {
+      epoch_retire(node, done);
+    } else {
+      done(node);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Compacts a TS_LOCALITY map's chains, a few buckets per call: each chain
+ * whose entries aren't laid out one after another is copied into
+ * consecutive entries of its stripe's slab. Calls carry on where the last
+ * one stopped, so calling this now and then keeps an aging map compact
+ * (a TS_MAINTAIN map does that on its own). Safe alongside any operation.
+ * @param map a pointer to the map
+ * @param buckets how many buckets to look at
+ * @return the number of chains moved, or 0 if the map isn't TS_LOCALITY
+ */
+int map_defrag(ts_hashmap_t *map, int buckets) {
+  if (map->slabs == NULL) {
+    return 0;
+  }
+  return defrag(map, buckets, 1);
+}
+
+/**
+ * Visits every key in [lo, hi] in ascending order, along with its value.
+ * Needs a map created with TS_INDEX; runs concurrently with get/put/del
+ * and sees each key as it was at some point during the scan.
+ * @param map a pointer to the map
+ * @param lo smallest key to visit
+ * @param hi largest key to visit
+ * @param visit called with each key, its value, and arg
+ * @param arg passed through to visit
+ * @return the number of keys visited, or -1 if the map has no index
+ */
+int range_scan(ts_hashmap_t *map, int lo, int hi, void (*visit)(int, int, void*), void *arg) {
+  if (map->index == NULL) {
+    return -1;
+  }
+  return index_range(map->index, lo, hi, visit, arg);
+}
+
+
+/**
+ * Reports what an adaptive map has observed and how it has reacted. Other
+ * maps only fill in capacity and size.
+ * @param map a pointer to the map
+ * @param stats where to store the numbers
+ */
+void map_stats(ts_hashmap_t *map, ts_stats_t *stats) {
+  memset(stats, 0, sizeof(ts_stats_t));
+  if (map->adapt != NULL) {
+    ts_adapt_t *adapt = map->adapt;
+    *stats = adapt->total;
+    // add the window that's still open
+    stats->reads += __atomic_load_n(&adapt->reads, __ATOMIC_RELAXED);
+    stats->writes += __atomic_load_n(&adapt->writes, __ATOMIC_RELAXED);
+    stats->contended += __atomic_load_n(&adapt->contended, __ATOMIC_RELAXED);
+    stats->retries += __atomic_load_n(&adapt->retries, __ATOMIC_RELAXED);
+    stats->optimistic = __atomic_load_n(&adapt->optimistic, __ATOMIC_RELAXED);
+    stats->resizing = __atomic_load_n(&adapt->resizing, __ATOMIC_RELAXED) != RESIZE_IDLE;
+  }
+  stats->capacity = __atomic_load_n(&map->capacity, __ATOMIC_RELAXED);
+  stats->size = __atomic_load_n(&map->size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reports the progress and backlog of a map's maintenance thread.
+ * @param map a pointer to the map
+ * @param stats where to store the numbers
+ * @return 0, or -1 if the map has no maintenance thread
+ */
+int maintenance_stats(ts_hashmap_t *map, ts_maint_stats_t *stats) {
+  memset(stats, 0, sizeof(ts_maint_stats_t));
+  if (map->maint == NULL) {
+    return -1;
+  }
+  ts_backlog_t *backlog = map->backlog;
+  stats->passes = map->maint->passes;
+  stats->cpuSeconds = map->maint->cpuSeconds;
+  stats->reclaimed = backlog->reclaimed;
+  stats->migrated = backlog->migrated;
+  stats->cooled = backlog->cooled;
+  stats->compacted = backlog->compacted;
+  stats->purged = backlog->purged;
+  stats->pendingReclaim = backlog->limbo;
+  for (int i = 0; i < map->numStripes; i++) {
+    stats->pendingReclaim += __atomic_load_n(&backlog->pending[i].count, __ATOMIC_RELAXED);
+  }
+  if (map->adapt != NULL && __atomic_load_n(&map->adapt->resizing, __ATOMIC_ACQUIRE) == RESIZE_MIGRATING) {
+    stats->resizing = 1;
+    stats->pendingMigrate = map->adapt->oldCapacity - __atomic_load_n(&map->adapt->migrateDone, __ATOMIC_RELAXED);
+  }
+  return 0;
+}
+
+/**
+ * Returns how many bytes of its registry's budget a map is charged for:
+ * its table and the entries it has allocated and not yet given back.
+ * @param map a pointer to the map
+ * @return the bytes, or 0 for a map outside a registry
+ */
+long map_memory(ts_hashmap_t *map) {
+  return __atomic_load_n(&map->memory, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reports how a TS_CACHE map's eviction policy is doing.
+ * @param map a pointer to the map
+ * @param stats where to store the numbers
+ * @return 0, or -1 if the map isn't a cache
+ */
+int cache_stats(ts_hashmap_t *map, ts_cache_stats_t *stats) {
+  memset(stats, 0, sizeof(ts_cache_stats_t));
+  ts_cache_t *cache = map->cache;
+  if (cache == NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&cache->lock);
+  stats->maxEntries = cache->maxEntries;
+  stats->window = cache->count[CACHE_WINDOW];
+  stats->probation = cache->count[CACHE_PROBATION];
+  stats->protect = cache->count[CACHE_PROTECTED];
+  stats->admitted = cache->admitted;
+  stats->rejected = cache->rejected;
+  stats->evicted = cache->evicted;
+  pthread_mutex_unlock(&cache->lock);
+  return 0;
+}
 
 /**
  * Prints the contents of the map (given)
@@ -137,9 +2464,17 @@ int del(ts_hashmap_t *map, int key) {
 void printmap(ts_hashmap_t *map) {
   for (int i = 0; i < map->capacity; i++) {
     printf("[%d] -> ", i);
-    ts_entry_t *entry = map->table[i];
+    ts_entry_t *entry = *head_of(map, map->table, i);
+    // halfway through a resize; the chain is in the new table now
+    if (entry == MOVED) {
+      printf("(moved)\n");
+      continue;
+    }
     while (entry != NULL) {
       printf("(%d,%d)", entry->key, entry->value);
+      // lazily deleted, not unlinked yet
+      if (entry->flags & TS_ENTRY_DEAD)
+        printf("x");
       if (entry->next != NULL)
         printf(" -> ");
       entry = entry->next;
@@ -153,19 +2488,92 @@ void printmap(ts_hashmap_t *map) {
  * @param map a pointer to the map
  */
 void freeMap(ts_hashmap_t *map) {
+  void (*release)(void*) = entry_free(map);
+  // stop housekeeping first, then free what it hadn't got to; a map in a
+  // registry just leaves it, and the registry's workers with it
+  if (map->registry != NULL) {
+    registry_remove(map->registry, map);
+  }
+  if (map->maint != NULL) {
+    if (map->registry == NULL) {
+      maint_stop(map->maint);
+    }
+    for (int i = 0; i < map->numStripes; i++) {
+      ts_entry_t *currEntry = map->backlog->pending[i].head;
+      while (currEntry != NULL) {
+        ts_entry_t *nextEntry = currEntry->next;
+        release(currEntry);
+        currEntry = nextEntry;
+      }
+    }
+    free(map->backlog->pending);
+    free(map->backlog);
+  }
+  // a resize that never finished leaves entries in both tables
+  if (map->adapt != NULL) {
+    if (map->adapt->newTable != map->table) {
+      for (int i = 0; i < map->adapt->newCapacity; i++) {
+        ts_entry_t *currEntry = map->adapt->newTable[i];
+        while (currEntry != NULL) {
+          ts_entry_t *nextEntry = currEntry->next;
+          free(currEntry->split);
+          if (!(currEntry->flags & TS_ENTRY_INTRUSIVE)) {
+            release(currEntry);
+          }
+          currEntry = nextEntry;
+        }
+      }
+      free(map->adapt->newTable);
+    }
+    free(map->adapt);
+  }
   // iterate through each list, free up all nodes
   for (int i = 0; i < map->capacity; i++) {
-    ts_entry_t *currEntry = (map->table)[i];
-    // free all the nodes in the bucket
+    ts_entry_t *currEntry = *head_of(map, map->table, i);
+    if (currEntry == MOVED) {
+      continue;
+    }
+    // free all the nodes in the bucket (except the callers' own)
     while (currEntry != NULL) {
       ts_entry_t *nextEntry = currEntry->next;
-      free(currEntry);
+      free(currEntry->split);
+      if (!(currEntry->flags & TS_ENTRY_INTRUSIVE)) {
+        release(currEntry);
+      }
       currEntry = nextEntry;
     }
   }
-  // TODO: free the hash table
+  // free the hash table
   free(map->table);
-  // TODO: destroy locks
+  // tear down the index once nothing retired from it is still pending
+  if (map->index != NULL) {
+    epoch_barrier();
+    index_free(map->index);
+  }
+  if (map->stream != NULL) {
+    stream_free(map->stream);
+  }
+  if (map->cache != NULL) {
+    cache_free(map->cache);
+  }
+  pthread_mutex_destroy(&map->hot->lock);
+  free(map->hot);
+  // destroy locks
+  for (int i = 0; i < map->numStripes; i++) {
+    lock_destroy(&map->stripes[i].lock);
+  }
+  free(map->stripes);
+  // entries retired to a slab have to be released before its pages go
+  if (map->slabs != NULL) {
+    epoch_barrier();
+    for (int i = 0; i < map->numStripes; i++) {
+      slab_destroy(&map->slabs[i]);
+    }
+    free(map->slabs);
+  }
+  if (map->registry != NULL) {
+    registry_charge(map->registry, &map->memory, -map->memory);
+  }
 
   // free the map itself:
   free(map);
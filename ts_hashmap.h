@@ -1,27 +1,209 @@
+#ifndef TS_HASHMAP_H_
+#define TS_HASHMAP_H_
+
 #include <pthread.h>
+#include <stddef.h>
+#include "ts_lock.h"
+
+// option flags for initmap_opts()
+#define TS_INDEX 0x1    // keep an ordered skip-list index for range scans
+#define TS_STREAM 0x2   // record every change in a change-data-capture stream
+#define TS_ADAPTIVE 0x4 // watch the workload and switch read mode / grow online
+#define TS_MAINTAIN 0x8 // hand housekeeping to a background thread
+#define TS_RCU 0x10     // lock-free gets; writers copy the chains they change
+#define TS_LOCALITY 0x20 // allocate entries near their chain; map_defrag
+#define TS_LAZY_DEL 0x40 // del only marks entries; they're unlinked later
+#define TS_CACHE 0x80    // keep to maxEntries keys, evicting by W-TinyLFU
+#define TS_COLOCATE 0x100 // keep bucket heads on their stripe lock's cache line
+
+// hash functions for ts_options_t.hash
+#define TS_HASH_MODULO 0   // (unsigned) key % capacity
+#define TS_HASH_MULT 1     // multiplicative hash, power-of-two table
+#define TS_HASH_MURMUR 2   // murmur3 finalizer, power-of-two table
+
+// entry flags
+#define TS_ENTRY_DEAD 0x1      // deleted by a TS_LAZY_DEL map, not unlinked yet
+#define TS_ENTRY_INTRUSIVE 0x2 // the caller's own node (see insert_node)
 
-// A hashmap entry stores the key, value
-// and a pointer to the next entry
+// A hashmap entry stores the key, value, TS_ENTRY_* flags
+// and a pointer to the next entry. A write-hot key also has a split
+// holding per-core sub-values that add to value (see ts_split.h).
 typedef struct ts_entry_t {
    int key;
    int value;
+   int flags;
    struct ts_entry_t *next;
+   struct ts_split_t *split;
 } ts_entry_t;
 
-// A hashmap contains an array of pointers to entries,
-// the capacity of the array, the size (number of entries stored), 
-// and the number of operations that it has run.
+// the object a node passed to insert_node is embedded in
+#define ts_node_owner(node, type, member) ((type*) ((char*) (node) - offsetof(type, member)))
+
+// bucket heads a TS_COLOCATE stripe holds
+#define STRIPE_HEADS 4
+
+// A lock stripe: on a TS_COLOCATE map, the heads of the buckets it guards
+// (bucket i is heads[i % STRIPE_HEADS] of stripe i / STRIPE_HEADS), which
+// share the first cache line with the start of the lock, so an operation
+// finds its lock and its chain with one miss; then the lock, a sequence
+// number that TS_ADAPTIVE maps bump around every structural change so
+// optimistic readers can tell whether they raced with a writer, and the
+// key whose fetch_adds have lately been waiting on the lock, with a score
+// of how often. Padded so stripes don't share a line; the heads take up
+// what would otherwise be padding.
+typedef struct ts_stripe_t {
+   struct ts_entry_t *heads[STRIPE_HEADS];
+   ts_lock_t lock;
+   unsigned seq;
+   int hotKey;
+   int hotCount;
+} __attribute__((aligned(64))) ts_stripe_t;
+
+// Options for creating a map: the capacity of the table, the number of
+// lock stripes protecting it (0 picks a default), TS_* flags, the
+// number of change records each stripe buffers for TS_STREAM (0 for
+// default), the TS_HASH_* function that picks a key's bucket, and the
+// TS_LOCK_* type of the stripe locks. With TS_MAINTAIN, maintBudget caps
+// the maintenance thread's CPU use in percent of one core (0 for default)
+// and maintNice is its nice value (MAINT_IDLE for SCHED_IDLE). A TS_CACHE
+// map keeps to maxEntries keys (0 for the capacity); the bound is soft,
+// as an insert evicts only once it has let go of its stripe lock, so
+// inserts in flight can each hold the map one key over it for a moment.
+// A TS_COLOCATE map has a stripe per STRIPE_HEADS buckets, whatever
+// numStripes says.
+typedef struct ts_options_t {
+   int capacity;
+   int numStripes;
+   int flags;
+   int streamCapacity;
+   int hash;
+   int lockType;
+   int maintBudget;
+   int maintNice;
+   int maxEntries;
+} ts_options_t;
+
+// A hashmap contains an array of pointers to entries (NULL on a
+// TS_COLOCATE map, whose stripes hold the heads), the capacity of the
+// array, the size (number of entries stored), and the number of
+// operations that it has run. Bucket i is protected by
+// stripes[i % numStripes], or stripes[i / STRIPE_HEADS] on a TS_COLOCATE map. The index, stream
+// and adapt are NULL unless the map was created with TS_INDEX /
+// TS_STREAM / TS_ADAPTIVE, maint and backlog unless it was created
+// with TS_MAINTAIN, and slabs (one per stripe) and defragNext (the next
+// bucket map_defrag looks at) are only used with TS_LOCALITY; hot lists
+// the keys currently split. A map created with initmap_in has its
+// registry, the first of the registry's slabs it allocates from, and the
+// bytes it's charged for. cache is the eviction policy of a TS_CACHE map.
+// The counters operations write go last, on a line of their own, so they
+// don't keep knocking the read-mostly fields out of other cores' caches.
 typedef struct ts_hashmap_t {
    ts_entry_t **table;
-   int numOps;
    int capacity;
+   ts_stripe_t *stripes;
+   int numStripes;
+   int lockType;
+   int flags;
+   int hash;
+   struct ts_index_t *index;
+   struct ts_stream_t *stream;
+   struct ts_adapt_t *adapt;
+   struct ts_hotkeys_t *hot;
+   struct ts_maint_t *maint;
+   struct ts_backlog_t *backlog;
+   struct ts_slab_t *slabs;
+   int defragNext;
+   struct ts_registry_t *registry;
+   int pool;
+   struct ts_cache_t *cache;
+   int numOps __attribute__((aligned(64)));
    int size;
+   long memory;
 } ts_hashmap_t;
 
+// What a TS_ADAPTIVE map has observed so far and how it has reacted:
+// operations seen, lock acquisitions that had to wait, optimistic reads
+// that lost a race and fell back to the lock, the longest chain a get
+// has walked, whether gets currently read optimistically, and how many
+// times the table has doubled
+typedef struct ts_stats_t {
+   long reads;
+   long writes;
+   long contended;
+   long retries;
+   int longestChain;
+   int optimistic;
+   int resizes;
+   int resizing;
+   int capacity;
+   int size;
+} ts_stats_t;
+
+// What a map's maintenance thread has done and what is still waiting for
+// it: passes run and CPU time used, entries freed, buckets migrated,
+// keys un-split, chains compacted and dead entries unlinked, entries
+// waiting to be freed, and buckets a running resize still has to move
+typedef struct ts_maint_stats_t {
+   long passes;
+   double cpuSeconds;
+   long reclaimed;
+   long migrated;
+   long cooled;
+   long compacted;
+   long purged;
+   long pendingReclaim;
+   int pendingMigrate;
+   int resizing;
+} ts_maint_stats_t;
+
+// How a TS_CACHE map is doing: its limit, the keys in each part of the
+// policy (the window new keys enter, and probation and protected in the
+// main space), how often a key leaving the window won a place there or
+// lost it, and the keys evicted
+typedef struct ts_cache_stats_t {
+   int maxEntries;
+   int window;
+   int probation;
+   int protect;
+   long admitted;
+   long rejected;
+   long evicted;
+} ts_cache_stats_t;
+
+// A thread's private context for one map (see map_register_thread)
+typedef struct ts_map_handle_t ts_map_handle_t;
+
 // function declarations
 ts_hashmap_t *initmap(int);
+ts_hashmap_t *initmap_opts(const ts_options_t*);
+ts_hashmap_t *initmap_in(struct ts_registry_t*, const ts_options_t*);
 int get(ts_hashmap_t*, int);
 int put(ts_hashmap_t*, int, int);
 int del(ts_hashmap_t*, int);
+int fetch_add(ts_hashmap_t*, int, int);
+int try_get(ts_hashmap_t*, int, int*);
+int try_put(ts_hashmap_t*, int, int, int*);
+int try_del(ts_hashmap_t*, int, int*);
+int get_until(ts_hashmap_t*, int, const struct timespec*, int*);
+int put_until(ts_hashmap_t*, int, int, const struct timespec*, int*);
+int del_until(ts_hashmap_t*, int, const struct timespec*, int*);
+ts_map_handle_t *map_register_thread(ts_hashmap_t*);
+void map_unregister_thread(ts_map_handle_t*);
+int hget(ts_map_handle_t*, int);
+int hput(ts_map_handle_t*, int, int);
+int hdel(ts_map_handle_t*, int);
+int hfetch_add(ts_map_handle_t*, int, int);
+void get_batch(ts_hashmap_t*, const int*, int*, int);
+void put_batch(ts_hashmap_t*, const int*, const int*, int*, int);
+int insert_node(ts_hashmap_t*, ts_entry_t*);
+int remove_node(ts_hashmap_t*, ts_entry_t*, void (*)(void*));
+int map_defrag(ts_hashmap_t*, int);
+int range_scan(ts_hashmap_t*, int, int, void (*)(int, int, void*), void*);
+void map_stats(ts_hashmap_t*, ts_stats_t*);
+int maintenance_stats(ts_hashmap_t*, ts_maint_stats_t*);
+long map_memory(ts_hashmap_t*);
+int cache_stats(ts_hashmap_t*, ts_cache_stats_t*);
 void printmap(ts_hashmap_t*);
-void freeMap(ts_hashmap_t*);
\ No newline at end of file
+void freeMap(ts_hashmap_t*);
+
+#endif /* TS_HASHMAP_H_ */
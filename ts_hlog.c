@@ -0,0 +1,396 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ts_hlog.h"
+#include "ts_simd.h"
+
+// how long an opener that couldn't write a page out waits before trying again
+#define FLUSH_RETRY_US 1000
+
+/**
+ * The record at a log address, in the frame its page is in. Only valid
+ * while the page is in memory.
+ */
+static ts_record_t *record_at(ts_hlog_t *log, uint64_t address) {
+  long page = address / HLOG_PAGE_RECORDS;
+  return &log->frames[(page % log->numFrames) * HLOG_PAGE_RECORDS + address % HLOG_PAGE_RECORDS];
+}
+
+/**
+ * Writes whole read-only pages out to the file, up to a log address. Pages
+ * before readOnly don't change any more, so no lock is needed to read them.
+ * @param until where to stop; the page it's in isn't written
+ * @return the number of pages written
+ */
+static int flush_until(ts_hlog_t *log, uint64_t until) {
+  int pages = 0;
+  pthread_mutex_lock(&log->flushLock);
+  uint64_t flushed = log->flushed;
+  while (flushed + HLOG_PAGE_RECORDS <= until) {
+    const char *page = (const char*) record_at(log, flushed);
+    off_t offset = (off_t) flushed * sizeof(ts_record_t);
+    int done = 0;
+    while (done < HLOG_PAGE) {
+      ssize_t n = pwrite(log->fd, page + done, HLOG_PAGE - done, offset + done);
+      if (n < 0 && errno != EINTR) {
+        break;
+      }
+      done += n > 0 ? n : 0;
+    }
+    // a page that didn't make it is tried again next time
+    if (done < HLOG_PAGE) {
+      break;
+    }
+    flushed += HLOG_PAGE_RECORDS;
+    pages++;
+  }
+  __atomic_store_n(&log->flushed, flushed, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&log->flushLock);
+  return pages;
+}
+
+/**
+ * The flusher's pass: writes out whatever has turned read-only.
+ */
+static int flush_pass(void *arg) {
+  ts_hlog_t *log = (ts_hlog_t*) arg;
+  return flush_until(log, __atomic_load_n(&log->readOnly, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Gets the frame of a new page ready, moving readOnly and head on a page:
+ * the page that turns read-only is handed to the flusher, and the oldest
+ * page in memory, once it's in the file, is dropped so the new one can
+ * have its frame. Called by whoever got the page's first record, without
+ * the region lock; pages are opened one at a time, in order.
+ */
+static void open_page(ts_hlog_t *log, long page) {
+  while (__atomic_load_n(&log->openPage, __ATOMIC_ACQUIRE) < page - 1) {
+    sched_yield();
+  }
+  uint64_t readOnly = page >= log->mutablePages ? (uint64_t) (page - log->mutablePages + 1) * HLOG_PAGE_RECORDS : 0;
+  if (readOnly > log->readOnly) {
+    // waits out every in-place update that saw the old boundary
+    lock_write(&log->region);
+    __atomic_store_n(&log->readOnly, readOnly, __ATOMIC_RELEASE);
+    unlock(&log->region);
+    if (log->flusher != NULL) {
+      maint_wake(log->flusher);
+    }
+  }
+  long evict = page - log->numFrames;
+  if (evict >= 0) {
+    uint64_t head = (uint64_t) (evict + 1) * HLOG_PAGE_RECORDS;
+    // the page has to be in the file before its frame is reused; if the
+    // flusher hasn't got to it, write it out here (and stall if the disk
+    // won't take it)
+    while (__atomic_load_n(&log->flushed, __ATOMIC_ACQUIRE) < head) {
+      if (flush_until(log, head) == 0) {
+        usleep(FLUSH_RETRY_US);
+      }
+    }
+    // waits out every read that might be in the frame
+    lock_write(&log->region);
+    __atomic_store_n(&log->head, head, __ATOMIC_RELEASE);
+    unlock(&log->region);
+  }
+  memset(record_at(log, (uint64_t) page * HLOG_PAGE_RECORDS), 0, HLOG_PAGE);
+  __atomic_store_n(&log->openPage, page, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hands out the next record at the tail. Called with the region held
+ * shared; lets go of it while the record's page is being opened, and if
+ * the record turned read-only meanwhile it's left empty (nothing points to
+ * it) and another one is taken.
+ * @return the record's address
+ */
+static uint64_t alloc_record(ts_hlog_t *log) {
+  while (1) {
+    uint64_t address = __atomic_fetch_add(&log->tail, 1, __ATOMIC_RELAXED);
+    long page = address / HLOG_PAGE_RECORDS;
+    if (__atomic_load_n(&log->openPage, __ATOMIC_ACQUIRE) < page) {
+      unlock(&log->region);
+      if (address % HLOG_PAGE_RECORDS == 0) {
+        open_page(log, page);
+      } else {
+        while (__atomic_load_n(&log->openPage, __ATOMIC_ACQUIRE) < page) {
+          sched_yield();
+        }
+      }
+      lock_read(&log->region);
+    }
+    if (address >= __atomic_load_n(&log->readOnly, __ATOMIC_RELAXED)) {
+      return address;
+    }
+    // its page turned read-only while we waited for it: leave a hole
+    __atomic_fetch_add(&log->skipped, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Walks the in-memory part of a key's chain.
+ * @param value where to store the key's value, if the walk settles it
+ * @param address where to store the address the walk left memory at
+ * @return 1 if the key's value was found (or the chain ended), 0 if the
+ * rest of the chain is on disk
+ */
+static int read_memory(ts_hlog_t *log, int key, int *value, uint64_t *address) {
+  lock_read(&log->region);
+  uint64_t head = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  uint64_t curr = __atomic_load_n(&log->buckets[hash_murmur(key) & log->mask], __ATOMIC_ACQUIRE);
+  while (curr != 0 && curr >= head) {
+    ts_record_t *record = record_at(log, curr);
+    if (record->key == key) {
+      *value = __atomic_load_n(&record->value, __ATOMIC_RELAXED);
+      unlock(&log->region);
+      return 1;
+    }
+    curr = record->prev;
+  }
+  unlock(&log->region);
+  *value = INT_MAX;
+  *address = curr;
+  return curr == 0;
+}
+
+/**
+ * Walks the rest of a key's chain in the file. Records there never change,
+ * so this needs no lock.
+ * @param address where the walk left memory
+ * @return the key's value, or INT_MAX if it isn't there (or can't be read)
+ */
+static int read_disk(ts_hlog_t *log, int key, uint64_t address) {
+  while (address != 0) {
+    ts_record_t record;
+    if (pread(log->fd, &record, sizeof(ts_record_t), (off_t) address * sizeof(ts_record_t)) != sizeof(ts_record_t)) {
+      return INT_MAX;
+    }
+    __atomic_fetch_add(&log->diskReads, 1, __ATOMIC_RELAXED);
+    if (record.key == key) {
+      return record.value;
+    }
+    address = record.prev;
+  }
+  return INT_MAX;
+}
+
+/**
+ * The reader's pass: serves every disk read queued so far, oldest first.
+ */
+static int read_pass(void *arg) {
+  ts_hlog_t *log = (ts_hlog_t*) arg;
+  pthread_mutex_lock(&log->readLock);
+  ts_hlog_read_t *queued = log->reads;
+  log->reads = NULL;
+  pthread_mutex_unlock(&log->readLock);
+  // the queue is pushed at the front; turn it around
+  ts_hlog_read_t *reads = NULL;
+  while (queued != NULL) {
+    ts_hlog_read_t *next = queued->next;
+    queued->next = reads;
+    reads = queued;
+    queued = next;
+  }
+  int served = 0;
+  while (reads != NULL) {
+    ts_hlog_read_t *next = reads->next;
+    reads->done(reads->key, read_disk(log, reads->key, reads->address), reads->arg);
+    free(reads);
+    reads = next;
+    served++;
+  }
+  return served;
+}
+
+/**
+ * Creates a log that spills to the given file, which is truncated.
+ * @param opts the file, index buckets, pages in memory and mutable percent
+ * @return a pointer to the new log, or NULL if the file can't be opened
+ */
+ts_hlog_t *hlog_init(const ts_hlog_options_t *opts) {
+  int fd = open(opts->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+  ts_hlog_t *log = (ts_hlog_t*) calloc(1, sizeof(ts_hlog_t));
+  log->fd = fd;
+  unsigned capacity = 2;
+  while (capacity < (unsigned) opts->capacity) {
+    capacity <<= 1;
+  }
+  log->buckets = (uint64_t*) calloc(capacity, sizeof(uint64_t));
+  log->mask = capacity - 1;
+  for (int i = 0; i < HLOG_STRIPES; i++) {
+    lock_init(&log->stripes[i], TS_LOCK_MUTEX);
+  }
+  // at least one page mutable and one read-only, so a page is always in
+  // the file by the time its frame is needed
+  log->numFrames = opts->pages > 2 ? opts->pages : opts->pages > 0 ? 2 : HLOG_DEFAULT_PAGES;
+  int pct = opts->mutablePct > 0 ? opts->mutablePct : HLOG_DEFAULT_MUTABLE_PCT;
+  log->mutablePages = log->numFrames * pct / 100;
+  if (log->mutablePages < 1) {
+    log->mutablePages = 1;
+  }
+  if (log->mutablePages > log->numFrames - 1) {
+    log->mutablePages = log->numFrames - 1;
+  }
+  log->frames = (ts_record_t*) aligned_alloc(HLOG_PAGE, (size_t) log->numFrames * HLOG_PAGE);
+  memset(log->frames, 0, (size_t) log->numFrames * HLOG_PAGE);
+  // address 0 means no record, so the log starts at 1
+  log->tail = 1;
+  log->openPage = 0;
+  // every operation takes the region shared; BRAVO keeps that cheap
+  lock_init(&log->region, TS_LOCK_BRAVO);
+  pthread_mutex_init(&log->flushLock, NULL);
+  pthread_mutex_init(&log->readLock, NULL);
+  log->flusher = maint_start(flush_pass, log, 0, 0);
+  // disk reads are mostly waiting, so the reader gets a whole core's budget
+  log->reader = maint_start(read_pass, log, 100, 0);
+  return log;
+}
+
+/**
+ * Sets a key's value: in place if the key's newest record is in the
+ * mutable tail, otherwise by appending a record.
+ * @param log the log
+ * @param key a key
+ * @param value its value
+ */
+void hlog_upsert(ts_hlog_t *log, int key, int value) {
+  unsigned bucket = hash_murmur(key) & log->mask;
+  ts_lock_t *lock = &log->stripes[bucket % HLOG_STRIPES];
+  lock_write(lock);
+  lock_read(&log->region);
+  uint64_t readOnly = __atomic_load_n(&log->readOnly, __ATOMIC_RELAXED);
+  uint64_t first = log->buckets[bucket];
+  for (uint64_t curr = first; curr != 0 && curr >= readOnly; curr = record_at(log, curr)->prev) {
+    ts_record_t *record = record_at(log, curr);
+    if (record->key == key) {
+      __atomic_store_n(&record->value, value, __ATOMIC_RELAXED);
+      unlock(&log->region);
+      unlock(lock);
+      __atomic_fetch_add(&log->inPlace, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  uint64_t address = alloc_record(log);
+  ts_record_t *record = record_at(log, address);
+  record->prev = first;
+  record->key = key;
+  record->value = value;
+  // readers find the record through its bucket, so it's filled in first
+  __atomic_store_n(&log->buckets[bucket], address, __ATOMIC_RELEASE);
+  unlock(&log->region);
+  unlock(lock);
+  __atomic_fetch_add(&log->appended, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Deletes a key by giving it the value INT_MAX.
+ * @param log the log
+ * @param key a key
+ */
+void hlog_delete(ts_hlog_t *log, int key) {
+  hlog_upsert(log, key, INT_MAX);
+}
+
+/**
+ * Reads a key's value, blocking on pread if its newest record is on disk.
+ * @param log the log
+ * @param key a key
+ * @return the key's value, or INT_MAX if it isn't there
+ */
+int hlog_read(ts_hlog_t *log, int key) {
+  int value;
+  uint64_t address;
+  if (read_memory(log, key, &value, &address)) {
+    return value;
+  }
+  return read_disk(log, key, address);
+}
+
+/**
+ * Reads a key's value without blocking on the disk: a read that can be
+ * answered from memory is, and one that has to go to the file is queued
+ * for the reader thread, which calls done with the key, its value (or
+ * INT_MAX) and arg once it has it.
+ * @param log the log
+ * @param key a key
+ * @param value where to store the value when it's in memory
+ * @param done called from the reader thread for a read that went to disk
+ * @param arg passed through to done
+ * @return 0 if value was stored, or EINPROGRESS if done will be called
+ */
+int hlog_read_async(ts_hlog_t *log, int key, int *value, void (*done)(int, int, void*), void *arg) {
+  uint64_t address;
+  if (read_memory(log, key, value, &address)) {
+    return 0;
+  }
+  if (log->reader == NULL) {
+    *value = read_disk(log, key, address);
+    return 0;
+  }
+  ts_hlog_read_t *read = (ts_hlog_read_t*) malloc(sizeof(ts_hlog_read_t));
+  read->key = key;
+  read->address = address;
+  read->done = done;
+  read->arg = arg;
+  pthread_mutex_lock(&log->readLock);
+  read->next = log->reads;
+  log->reads = read;
+  pthread_mutex_unlock(&log->readLock);
+  maint_wake(log->reader);
+  return EINPROGRESS;
+}
+
+/**
+ * Reports how a log's records are spread over memory and disk.
+ * @param log the log
+ * @param stats where to store the numbers
+ */
+void hlog_stats(ts_hlog_t *log, ts_hlog_stats_t *stats) {
+  memset(stats, 0, sizeof(ts_hlog_stats_t));
+  lock_read(&log->region);
+  uint64_t tail = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+  uint64_t readOnly = __atomic_load_n(&log->readOnly, __ATOMIC_RELAXED);
+  uint64_t head = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  unlock(&log->region);
+  // addresses start at 1
+  stats->records = tail - 1;
+  stats->mutableRecords = tail - (readOnly > 1 ? readOnly : 1);
+  stats->readOnlyRecords = readOnly > 1 ? readOnly - (head > 1 ? head : 1) : 0;
+  stats->diskRecords = head > 1 ? head - 1 : 0;
+  stats->inPlace = __atomic_load_n(&log->inPlace, __ATOMIC_RELAXED);
+  stats->appended = __atomic_load_n(&log->appended, __ATOMIC_RELAXED);
+  stats->skipped = __atomic_load_n(&log->skipped, __ATOMIC_RELAXED);
+  stats->diskReads = __atomic_load_n(&log->diskReads, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stops the log's threads, finishes the reads still queued, and frees it.
+ * The file is closed but left where it is.
+ */
+void hlog_free(ts_hlog_t *log) {
+  if (log->flusher != NULL) {
+    maint_stop(log->flusher);
+  }
+  if (log->reader != NULL) {
+    maint_stop(log->reader);
+  }
+  read_pass(log);
+  close(log->fd);
+  for (int i = 0; i < HLOG_STRIPES; i++) {
+    lock_destroy(&log->stripes[i]);
+  }
+  lock_destroy(&log->region);
+  pthread_mutex_destroy(&log->flushLock);
+  pthread_mutex_destroy(&log->readLock);
+  free(log->frames);
+  free(log->buckets);
+  free(log);
+}
@@ -0,0 +1,136 @@
+/*
+ * ts_hlog.h
+ *
+ * A tiered key-value store for more data than fits in memory, after
+ * FASTER's HybridLog. Only the hash index stays in memory: its buckets
+ * hold the log address of the newest record of their chain, and each
+ * record the address of the one before it. Records live in a log whose
+ * newest pages are in memory and whose older ones have been written out
+ * to a file:
+ *
+ *   begin ......... head ............ readOnly ............ tail
+ *   |  on disk      |  in memory,      |  in memory,          |
+ *   |  (pread)      |  read-only       |  updated in place    |
+ *
+ * An upsert of a key whose record is in the mutable tail just overwrites
+ * its value; otherwise it appends a new record at the tail, so hot keys
+ * stay in memory while cold ones age out to disk on their own. As the
+ * tail moves on, readOnly and head follow it a page at a time: pages that
+ * turn read-only are written to the file in the background, and the
+ * oldest page in memory is dropped to make room for the newest. Reads
+ * that reach the disk either block on pread or, through hlog_read_async,
+ * are handed to a worker thread and completed with a callback.
+ *
+ * Values are ints and INT_MAX means absent, as in ts_hashmap_t: a delete
+ * appends (or writes in place) a record whose value is INT_MAX. Old
+ * versions of a record are never reclaimed from the file.
+ */
+
+#ifndef TS_HLOG_H_
+#define TS_HLOG_H_
+
+#include <stdint.h>
+#include "ts_lock.h"
+#include "ts_maint.h"
+
+// bytes in a log page, which is also the unit written to the file
+#define HLOG_PAGE 4096
+
+// default number of pages kept in memory, and the percent of them that
+// are the mutable tail
+#define HLOG_DEFAULT_PAGES 64
+#define HLOG_DEFAULT_MUTABLE_PCT 90
+
+// lock stripes serializing writers to the index
+#define HLOG_STRIPES 64
+
+// A record in the log: the address of the previous record in its bucket's
+// chain (0 for none), and the key and value
+typedef struct ts_record_t {
+   uint64_t prev;
+   int key;
+   int value;
+} ts_record_t;
+
+// records in a page; a record's address is its index in the log, so
+// record a is in page a / HLOG_PAGE_RECORDS and at byte a * 16 of the file
+#define HLOG_PAGE_RECORDS (HLOG_PAGE / (int) sizeof(ts_record_t))
+
+// Options for creating a log: the file it spills to, the number of index
+// buckets, how many pages it keeps in memory (0 for default) and the
+// percent of those that are mutable (0 for default)
+typedef struct ts_hlog_options_t {
+   const char *path;
+   int capacity;
+   int pages;
+   int mutablePct;
+} ts_hlog_options_t;
+
+// A disk read handed to the reader thread: the key, the address the walk
+// down its chain got to, and who to tell
+typedef struct ts_hlog_read_t {
+   int key;
+   uint64_t address;
+   void (*done)(int, int, void*);
+   void *arg;
+   struct ts_hlog_read_t *next;
+} ts_hlog_read_t;
+
+// A log. buckets is the index and stripes the writers' locks on it.
+// frames holds the pages in memory (page p in frame p % numFrames). The
+// boundaries are record addresses: tail is the next one to hand out,
+// records from readOnly on may be updated in place, and from head on are
+// in memory; everything before flushed is in the file. openPage is the
+// newest page whose frame is ready. region is held shared by every
+// operation and exclusive to move readOnly and head. The flusher writes
+// read-only pages out; the reader serves the queue of disk reads.
+typedef struct ts_hlog_t {
+   uint64_t *buckets;
+   unsigned mask;
+   ts_lock_t stripes[HLOG_STRIPES];
+   ts_record_t *frames;
+   int numFrames;
+   int mutablePages;
+   int fd;
+   uint64_t tail;
+   uint64_t readOnly;
+   uint64_t head;
+   uint64_t flushed;
+   long openPage;
+   ts_lock_t region;
+   pthread_mutex_t flushLock;
+   ts_maint_t *flusher;
+   ts_maint_t *reader;
+   pthread_mutex_t readLock;
+   ts_hlog_read_t *reads;
+   long inPlace;
+   long appended;
+   long skipped;
+   long diskReads;
+} ts_hlog_t;
+
+// Where a log's records are: the addresses handed out, how many are in
+// the mutable tail, in the read-only region and on disk only, updates done
+// in place, records appended, addresses left empty because their page
+// turned read-only before they were written (so records is appended plus
+// skipped), and records read from the file
+typedef struct ts_hlog_stats_t {
+   long records;
+   long mutableRecords;
+   long readOnlyRecords;
+   long diskRecords;
+   long inPlace;
+   long appended;
+   long skipped;
+   long diskReads;
+} ts_hlog_stats_t;
+
+ts_hlog_t *hlog_init(const ts_hlog_options_t*);
+void hlog_upsert(ts_hlog_t*, int, int);
+void hlog_delete(ts_hlog_t*, int);
+int hlog_read(ts_hlog_t*, int);
+int hlog_read_async(ts_hlog_t*, int, int*, void (*)(int, int, void*), void*);
+void hlog_stats(ts_hlog_t*, ts_hlog_stats_t*);
+void hlog_free(ts_hlog_t*);
+
+#endif /* TS_HLOG_H_ */
@@ -0,0 +1,241 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ts_epoch.h"
+#include "ts_index.h"
+#include "ts_split.h"
+
+// the low bit of a next pointer marks its node as logically deleted
+#define MARKED(p) ((ts_inode_t*) ((uintptr_t) (p) | 1))
+#define UNMARKED(p) ((ts_inode_t*) ((uintptr_t) (p) & ~(uintptr_t) 1))
+#define IS_MARKED(p) ((uintptr_t) (p) & 1)
+
+static __thread unsigned levelSeed = 0;
+
+/**
+ * Picks a tower height with P(h) = (1/4)^(h-1), using a per-thread xorshift
+ * (the caller's own seed if it passes one).
+ */
+static int random_height(unsigned *seed) {
+  if (seed == NULL) {
+    seed = &levelSeed;
+  }
+  if (*seed == 0) {
+    *seed = (unsigned) (uintptr_t) seed | 1;
+  }
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  int height = 1;
+  unsigned bits = *seed;
+  while (height < INDEX_MAX_HEIGHT && (bits & 3) == 0) {
+    height++;
+    bits >>= 2;
+  }
+  return height;
+}
+
+static ts_inode_t *new_inode(int key, int height) {
+  ts_inode_t *node = (ts_inode_t*) malloc(sizeof(ts_inode_t) + height * sizeof(ts_inode_t*));
+  node->key = key;
+  node->height = height;
+  node->entry = NULL;
+  for (int i = 0; i < height; i++) {
+    node->next[i] = NULL;
+  }
+  return node;
+}
+
+/**
+ * Locates the predecessors and successors of key on every level, snipping
+ * out any marked nodes it passes. Must be called inside an epoch.
+ * @return 1 if an unmarked node with this key was found at the bottom level
+ */
+static int find(ts_index_t *index, int key, ts_inode_t **preds, ts_inode_t **succs) {
+retry:
+  ;
+  ts_inode_t *pred = index->head;
+  for (int level = INDEX_MAX_HEIGHT - 1; level >= 0; level--) {
+    ts_inode_t *curr = UNMARKED(__atomic_load_n(&pred->next[level], __ATOMIC_ACQUIRE));
+    while (curr != NULL) {
+      ts_inode_t *succ = __atomic_load_n(&curr->next[level], __ATOMIC_ACQUIRE);
+      // curr is being deleted: help by unlinking it from this level
+      while (IS_MARKED(succ)) {
+        ts_inode_t *expected = curr;
+        if (!__atomic_compare_exchange_n(&pred->next[level], &expected, UNMARKED(succ), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+          goto retry;
+        }
+        curr = UNMARKED(succ);
+        if (curr == NULL) {
+          break;
+        }
+        succ = __atomic_load_n(&curr->next[level], __ATOMIC_ACQUIRE);
+      }
+      if (curr == NULL || curr->key >= key) {
+        break;
+      }
+      pred = curr;
+      curr = UNMARKED(succ);
+    }
+    preds[level] = pred;
+    succs[level] = curr;
+  }
+  return succs[0] != NULL && succs[0]->key == key;
+}
+
+/**
+ * Creates an empty index.
+ * @return a pointer to a new index
+ */
+ts_index_t *index_init() {
+  ts_index_t *index = (ts_index_t*) malloc(sizeof(ts_index_t));
+  index->head = new_inode(INT_MIN, INDEX_MAX_HEIGHT);
+  return index;
+}
+
+/**
+ * Adds a hash table entry to the index. The map serializes insert and
+ * remove for any one key with its bucket lock, so only different keys race.
+ * @param index a pointer to the index
+ * @param entry the entry to index
+ * @param seed the caller's random seed for the tower height, or NULL
+ * @return 1 if the entry was added, 0 if its key was already present
+ */
+int index_insert(ts_index_t *index, ts_entry_t *entry, unsigned *seed) {
+  ts_inode_t *preds[INDEX_MAX_HEIGHT];
+  ts_inode_t *succs[INDEX_MAX_HEIGHT];
+  int height = random_height(seed);
+  ts_inode_t *node = new_inode(entry->key, height);
+  node->entry = entry;
+  epoch_enter();
+  while (1) {
+    if (find(index, entry->key, preds, succs)) {
+      epoch_exit();
+      free(node);
+      return 0;
+    }
+    for (int i = 0; i < height; i++) {
+      node->next[i] = succs[i];
+    }
+    // linking the bottom level is what makes the key visible
+    ts_inode_t *expected = succs[0];
+    if (__atomic_compare_exchange_n(&preds[0]->next[0], &expected, node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  // then build the tower, refreshing neighbours whenever a link fails
+  for (int level = 1; level < height; level++) {
+    while (1) {
+      ts_inode_t *expected = succs[level];
+      if (__atomic_compare_exchange_n(&preds[level]->next[level], &expected, node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        break;
+      }
+      find(index, entry->key, preds, succs);
+      __atomic_store_n(&node->next[level], succs[level], __ATOMIC_RELAXED);
+    }
+  }
+  epoch_exit();
+  return 1;
+}
+
+/**
+ * Removes a key from the index. The node is marked top-down, unlinked by a
+ * final search, and its memory is retired through the epoch system.
+ * @param index a pointer to the index
+ * @param key the key to remove
+ * @return 1 if the key was removed, 0 if it wasn't indexed
+ */
+int index_remove(ts_index_t *index, int key) {
+  ts_inode_t *preds[INDEX_MAX_HEIGHT];
+  ts_inode_t *succs[INDEX_MAX_HEIGHT];
+  epoch_enter();
+  if (!find(index, key, preds, succs)) {
+    epoch_exit();
+    return 0;
+  }
+  ts_inode_t *node = succs[0];
+  // mark the upper levels so no new node is linked behind this one
+  for (int level = node->height - 1; level >= 1; level--) {
+    ts_inode_t *succ = __atomic_load_n(&node->next[level], __ATOMIC_ACQUIRE);
+    while (!IS_MARKED(succ)) {
+      __atomic_compare_exchange_n(&node->next[level], &succ, MARKED(succ), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+  }
+  // marking the bottom level is the logical delete
+  ts_inode_t *succ = __atomic_load_n(&node->next[0], __ATOMIC_ACQUIRE);
+  while (!IS_MARKED(succ)) {
+    if (__atomic_compare_exchange_n(&node->next[0], &succ, MARKED(succ), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      // search once more to physically unlink it from every level
+      find(index, key, preds, succs);
+      epoch_exit();
+      epoch_retire(node, free);
+      return 1;
+    }
+  }
+  epoch_exit();
+  return 0;
+}
+
+/**
+ * Points a key's node at a new entry, for maps that replace entries rather
+ * than update them in place (TS_RCU). Called with the key's stripe lock held.
+ * @param index the index
+ * @param entry the entry now holding the key
+ * @return 1 if the key was found, 0 otherwise
+ */
+int index_replace(ts_index_t *index, ts_entry_t *entry) {
+  ts_inode_t *preds[INDEX_MAX_HEIGHT];
+  ts_inode_t *succs[INDEX_MAX_HEIGHT];
+  epoch_enter();
+  int found = find(index, entry->key, preds, succs);
+  if (found) {
+    __atomic_store_n(&succs[0]->entry, entry, __ATOMIC_RELEASE);
+  }
+  epoch_exit();
+  return found;
+}
+
+/**
+ * Visits every indexed key in [lo, hi] in ascending order.
+ * @param index a pointer to the index
+ * @param lo smallest key to visit
+ * @param hi largest key to visit
+ * @param visit called with each key, its value, and arg
+ * @param arg passed through to visit
+ * @return the number of keys visited
+ */
+int index_range(ts_index_t *index, int lo, int hi, void (*visit)(int, int, void*), void *arg) {
+  ts_inode_t *preds[INDEX_MAX_HEIGHT];
+  ts_inode_t *succs[INDEX_MAX_HEIGHT];
+  int count = 0;
+  epoch_enter();
+  find(index, lo, preds, succs);
+  ts_inode_t *curr = succs[0];
+  while (curr != NULL && curr->key <= hi) {
+    ts_inode_t *succ = __atomic_load_n(&curr->next[0], __ATOMIC_ACQUIRE);
+    // skip nodes that were deleted after the search passed them, and
+    // entries a lazy del has marked but not unlinked yet
+    ts_entry_t *entry = __atomic_load_n(&curr->entry, __ATOMIC_ACQUIRE);
+    if (!IS_MARKED(succ) && !(__atomic_load_n(&entry->flags, __ATOMIC_ACQUIRE) & TS_ENTRY_DEAD)) {
+      visit(curr->key, entry_value(entry), arg);
+      count++;
+    }
+    curr = UNMARKED(succ);
+  }
+  epoch_exit();
+  return count;
+}
+
+/**
+ * Frees the index. The caller guarantees no other thread is using it.
+ * @param index a pointer to the index
+ */
+void index_free(ts_index_t *index) {
+  ts_inode_t *curr = index->head;
+  while (curr != NULL) {
+    ts_inode_t *next = UNMARKED(curr->next[0]);
+    free(curr);
+    curr = next;
+  }
+  free(index);
+}
@@ -0,0 +1,38 @@
+/*
+ * ts_index.h
+ *
+ * Ordered companion index for a ts_hashmap_t: a lock-free skip list whose
+ * nodes point at the hash table's entries, so values are shared with the
+ * table rather than copied.
+ */
+
+#ifndef TS_INDEX_H_
+#define TS_INDEX_H_
+
+#include "ts_hashmap.h"
+
+// tallest tower a node can have; plenty for 2^32 keys at p = 1/4
+#define INDEX_MAX_HEIGHT 16
+
+// A skip list node stores the key, a pointer to the hash table entry
+// holding its value, and one (possibly marked) next pointer per level
+typedef struct ts_inode_t {
+   int key;
+   int height;
+   ts_entry_t *entry;
+   struct ts_inode_t *next[];
+} ts_inode_t;
+
+// An index is a sentinel head node whose tower spans every level
+typedef struct ts_index_t {
+   ts_inode_t *head;
+} ts_index_t;
+
+ts_index_t *index_init();
+int index_insert(ts_index_t*, ts_entry_t*, unsigned*);
+int index_remove(ts_index_t*, int);
+int index_replace(ts_index_t*, ts_entry_t*);
+int index_range(ts_index_t*, int, int, void (*)(int, int, void*), void*);
+void index_free(ts_index_t*);
+
+#endif /* TS_INDEX_H_ */
@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include "ts_lock.h"
+
+// the TS_LOCK_BRAVO reader table has 1 << BRAVO_SLOT_BITS slots
+#define BRAVO_SLOT_BITS 12
+
+// how many times as long as a revocation took the bias then stays off
+#define BRAVO_INHIBIT 9
+
+// read locks a thread can hold through the table at once; beyond that it
+// takes the rwlock
+#define BRAVO_HELD 4
+
+// The TS_LOCK_BRAVO reader table, shared by all such locks: a slot holds
+// the lock its reader is in, or NULL
+static ts_lock_t *readers[1 << BRAVO_SLOT_BITS];
+
+// the slots this thread holds read locks through
+static __thread int held[BRAVO_HELD];
+static __thread int numHeld;
+
+static long now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Picks the calling thread's reader slot for a lock.
+ */
+static int reader_slot(ts_lock_t *lock) {
+  uint64_t x = (uintptr_t) lock ^ ((uintptr_t) pthread_self() >> 6);
+  return (int) ((x * 0x9E3779B97F4A7C15ull) >> (64 - BRAVO_SLOT_BITS));
+}
+
+/**
+ * A BRAVO reader's fast path: claims its slot while the lock is biased.
+ * @return 1 if the lock is now held for reading, 0 if the caller has to
+ * take the rwlock
+ */
+static int bravo_read(ts_lock_t *lock) {
+  if (!__atomic_load_n(&lock->bias, __ATOMIC_RELAXED) || numHeld == BRAVO_HELD) {
+    return 0;
+  }
+  int slot = reader_slot(lock);
+  ts_lock_t *expected = NULL;
+  if (!__atomic_compare_exchange_n(&readers[slot], &expected, lock, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  // a writer may have turned the bias off before it could see our slot
+  if (!__atomic_load_n(&lock->bias, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&readers[slot], NULL, __ATOMIC_RELEASE);
+    return 0;
+  }
+  held[numHeld++] = slot;
+  return 1;
+}
+
+/**
+ * Turns a BRAVO lock's bias back on once its inhibit time is over. Called
+ * with the rwlock held for reading, so no writer is between revoking the
+ * bias and unlocking.
+ */
+static void bravo_rebias(ts_lock_t *lock) {
+  if (!__atomic_load_n(&lock->bias, __ATOMIC_RELAXED)
+      && now_ns() >= __atomic_load_n(&lock->inhibitUntil, __ATOMIC_RELAXED)) {
+    // release: fast-path readers see the last writer's changes through it
+    __atomic_store_n(&lock->bias, 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Called by a BRAVO writer holding the rwlock: turns the bias off and
+ * waits for every reader that got in through the table to leave.
+ */
+static void bravo_revoke(ts_lock_t *lock) {
+  if (!__atomic_load_n(&lock->bias, __ATOMIC_RELAXED)) {
+    return;
+  }
+  long start = now_ns();
+  __atomic_store_n(&lock->bias, 0, __ATOMIC_SEQ_CST);
+  for (int i = 0; i < (1 << BRAVO_SLOT_BITS); i++) {
+    while (__atomic_load_n(&readers[i], __ATOMIC_SEQ_CST) == lock) {
+      sched_yield();
+    }
+  }
+  long end = now_ns();
+  __atomic_store_n(&lock->inhibitUntil, end + (end - start) * BRAVO_INHIBIT, __ATOMIC_RELAXED);
+}
+
+/**
+ * Initializes a lock of the given type.
+ * @param lock the lock
+ * @param type one of the TS_LOCK_* types
+ */
+void lock_init(ts_lock_t *lock, int type) {
+  lock->type = type;
+  switch (type) {
+    case TS_LOCK_SPIN:
+      pthread_spin_init(&lock->spin, PTHREAD_PROCESS_PRIVATE);
+      break;
+    case TS_LOCK_BRAVO:
+      lock->bias = 1;
+      lock->inhibitUntil = 0;
+      // fall through
+    case TS_LOCK_RW:
+      pthread_rwlock_init(&lock->rw, NULL);
+      break;
+    default:
+      lock->type = TS_LOCK_MUTEX;
+      pthread_mutex_init(&lock->mutex, NULL);
+  }
+}
+
+void lock_destroy(ts_lock_t *lock) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      pthread_spin_destroy(&lock->spin);
+      break;
+    case TS_LOCK_RW:
+    case TS_LOCK_BRAVO:
+      pthread_rwlock_destroy(&lock->rw);
+      break;
+    default:
+      pthread_mutex_destroy(&lock->mutex);
+  }
+}
+
+/**
+ * Acquires the lock for reading.
+ */
+void lock_read(ts_lock_t *lock) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      pthread_spin_lock(&lock->spin);
+      break;
+    case TS_LOCK_RW:
+      pthread_rwlock_rdlock(&lock->rw);
+      break;
+    case TS_LOCK_BRAVO:
+      if (!bravo_read(lock)) {
+        pthread_rwlock_rdlock(&lock->rw);
+        bravo_rebias(lock);
+      }
+      break;
+    default:
+      pthread_mutex_lock(&lock->mutex);
+  }
+}
+
+/**
+ * Acquires the lock for writing.
+ */
+void lock_write(ts_lock_t *lock) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      pthread_spin_lock(&lock->spin);
+      break;
+    case TS_LOCK_RW:
+      pthread_rwlock_wrlock(&lock->rw);
+      break;
+    case TS_LOCK_BRAVO:
+      pthread_rwlock_wrlock(&lock->rw);
+      bravo_revoke(lock);
+      break;
+    default:
+      pthread_mutex_lock(&lock->mutex);
+  }
+}
+
+/**
+ * Tries to acquire the lock for reading without waiting.
+ * @return 0 if the lock was acquired, nonzero if it is busy
+ */
+int lock_try_read(ts_lock_t *lock) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      return pthread_spin_trylock(&lock->spin);
+    case TS_LOCK_RW:
+      return pthread_rwlock_tryrdlock(&lock->rw);
+    case TS_LOCK_BRAVO:
+      if (bravo_read(lock)) {
+        return 0;
+      }
+      if (pthread_rwlock_tryrdlock(&lock->rw) != 0) {
+        return EBUSY;
+      }
+      bravo_rebias(lock);
+      return 0;
+    default:
+      return pthread_mutex_trylock(&lock->mutex);
+  }
+}
+
+/**
+ * Tries to acquire the lock for writing without waiting.
+ * @return 0 if the lock was acquired, nonzero if it is busy
+ */
+int lock_try_write(ts_lock_t *lock) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      return pthread_spin_trylock(&lock->spin);
+    case TS_LOCK_RW:
+      return pthread_rwlock_trywrlock(&lock->rw);
+    case TS_LOCK_BRAVO:
+      if (pthread_rwlock_trywrlock(&lock->rw) != 0) {
+        return EBUSY;
+      }
+      bravo_revoke(lock);
+      return 0;
+    default:
+      return pthread_mutex_trylock(&lock->mutex);
+  }
+}
+
+/**
+ * Whether an absolute CLOCK_REALTIME deadline has passed.
+ */
+static int expired(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec > deadline->tv_sec
+      || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/**
+ * Spins on a spinlock until it's free or the deadline passes. A spinlock
+ * can't park, so this yields between tries instead.
+ */
+static int spin_until(pthread_spinlock_t *spin, const struct timespec *deadline) {
+  while (pthread_spin_trylock(spin) != 0) {
+    if (expired(deadline)) {
+      return ETIMEDOUT;
+    }
+    sched_yield();
+  }
+  return 0;
+}
+
+/**
+ * Acquires the lock for reading, waiting no later than a deadline.
+ * @param deadline an absolute CLOCK_REALTIME time, as for pthread_mutex_timedlock
+ * @return 0 if the lock was acquired, ETIMEDOUT if the deadline passed first
+ */
+int lock_timed_read(ts_lock_t *lock, const struct timespec *deadline) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      return spin_until(&lock->spin, deadline);
+    case TS_LOCK_RW:
+      return pthread_rwlock_timedrdlock(&lock->rw, deadline);
+    case TS_LOCK_BRAVO:
+      if (bravo_read(lock)) {
+        return 0;
+      }
+      if (pthread_rwlock_timedrdlock(&lock->rw, deadline) != 0) {
+        return ETIMEDOUT;
+      }
+      bravo_rebias(lock);
+      return 0;
+    default:
+      return pthread_mutex_timedlock(&lock->mutex, deadline);
+  }
+}
+
+/**
+ * Acquires the lock for writing, waiting no later than a deadline.
+ * @param deadline an absolute CLOCK_REALTIME time, as for pthread_mutex_timedlock
+ * @return 0 if the lock was acquired, ETIMEDOUT if the deadline passed first
+ */
+int lock_timed_write(ts_lock_t *lock, const struct timespec *deadline) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      return spin_until(&lock->spin, deadline);
+    case TS_LOCK_RW:
+      return pthread_rwlock_timedwrlock(&lock->rw, deadline);
+    case TS_LOCK_BRAVO:
+      if (pthread_rwlock_timedwrlock(&lock->rw, deadline) != 0) {
+        return ETIMEDOUT;
+      }
+      // readers already inside are short; the deadline covers getting in
+      bravo_revoke(lock);
+      return 0;
+    default:
+      return pthread_mutex_timedlock(&lock->mutex, deadline);
+  }
+}
+
+/**
+ * Releases the lock, whichever way it was acquired.
+ */
+void unlock(ts_lock_t *lock) {
+  switch (lock->type) {
+    case TS_LOCK_SPIN:
+      pthread_spin_unlock(&lock->spin);
+      break;
+    case TS_LOCK_RW:
+      pthread_rwlock_unlock(&lock->rw);
+      break;
+    case TS_LOCK_BRAVO:
+      // a reader that came in through the table just gives its slot back
+      for (int i = numHeld - 1; i >= 0; i--) {
+        if (readers[held[i]] == lock) {
+          __atomic_store_n(&readers[held[i]], NULL, __ATOMIC_RELEASE);
+          held[i] = held[--numHeld];
+          return;
+        }
+      }
+      pthread_rwlock_unlock(&lock->rw);
+      break;
+    default:
+      pthread_mutex_unlock(&lock->mutex);
+  }
+}
+
+/**
+ * Names a lock type, for reports.
+ */
+const char *lock_name(int type) {
+  switch (type) {
+    case TS_LOCK_SPIN:
+      return "spin";
+    case TS_LOCK_RW:
+      return "rw";
+    case TS_LOCK_BRAVO:
+      return "bravo";
+    default:
+      return "mutex";
+  }
+}
@@ -0,0 +1,52 @@
+/*
+ * ts_lock.h
+ *
+ * The stripe lock used by ts_hashmap_t. A map picks one TS_LOCK_* type
+ * when it's created; readers (get) take it shared and writers (put, del)
+ * take it exclusive, which only the reader-writer types tell apart.
+ */
+
+#ifndef TS_LOCK_H_
+#define TS_LOCK_H_
+
+#include <pthread.h>
+#include <time.h>
+
+// lock types for ts_options_t.lockType
+#define TS_LOCK_MUTEX 0   // pthread mutex: parks waiters
+#define TS_LOCK_SPIN 1    // pthread spinlock: never sleeps
+#define TS_LOCK_RW 2      // pthread rwlock: readers share the stripe
+#define TS_LOCK_BRAVO 3   // rwlock whose readers skip its counter (see below)
+#define TS_LOCK_TYPES 4
+
+// A TS_LOCK_BRAVO lock is a pthread rwlock with a reader bias. While the
+// bias is on, a reader doesn't touch the rwlock: it claims a slot of a
+// global table, picked by hashing the lock and the thread, so readers of
+// one lock write all over the table instead of to one shared counter. A writer turns the bias off,
+// takes the rwlock and waits for the lock's slots to empty; the bias
+// stays off for a while after (BRAVO_INHIBIT times as long as that took),
+// so frequent writers don't pay for the scan every time.
+
+typedef struct ts_lock_t {
+   int type;
+   union {
+      pthread_mutex_t mutex;
+      pthread_spinlock_t spin;
+      pthread_rwlock_t rw;
+   };
+   int bias;                 // TS_LOCK_BRAVO: readers may use the slots
+   long inhibitUntil;        // TS_LOCK_BRAVO: no bias before this (ns)
+} ts_lock_t;
+
+void lock_init(ts_lock_t*, int);
+void lock_destroy(ts_lock_t*);
+void lock_read(ts_lock_t*);
+void lock_write(ts_lock_t*);
+int lock_try_read(ts_lock_t*);
+int lock_try_write(ts_lock_t*);
+int lock_timed_read(ts_lock_t*, const struct timespec*);
+int lock_timed_write(ts_lock_t*, const struct timespec*);
+void unlock(ts_lock_t*);
+const char *lock_name(int);
+
+#endif /* TS_LOCK_H_ */
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "ts_maint.h"
+
+/**
+ * Returns the calling thread's CPU time in seconds.
+ */
+static double thread_cpu() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Drops the calling thread's priority. Linux applies nice values per
+ * thread; anything from MAINT_IDLE up asks for SCHED_IDLE, which only
+ * runs when a CPU would otherwise be idle. Failures are ignored: the
+ * worker just runs at normal priority.
+ */
+static void lower_priority(int nice) {
+  if (nice >= MAINT_IDLE) {
+    struct sched_param param = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  } else if (nice > 0) {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice);
+  }
+}
+
+/**
+ * The worker loop: run a pass, then sleep in proportion to the CPU time it
+ * took, so that time / (time + sleep) stays at the budget.
+ */
+static void *run(void *arg) {
+  ts_maint_t *maint = (ts_maint_t*) arg;
+  lower_priority(maint->nice);
+  pthread_mutex_lock(&maint->lock);
+  while (!maint->stop) {
+    pthread_mutex_unlock(&maint->lock);
+    double start = thread_cpu();
+    int work = maint->pass(maint->arg);
+    double used = thread_cpu() - start;
+    maint->passes++;
+    maint->cpuSeconds += used;
+    long sleep = MAINT_IDLE_NS;
+    if (work > 0) {
+      sleep = used * 1e9 * (100 - maint->budget) / maint->budget;
+    }
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += sleep / 1000000000L;
+    until.tv_nsec += sleep % 1000000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&maint->lock);
+    if (!maint->stop) {
+      pthread_cond_timedwait(&maint->wake, &maint->lock, &until);
+    }
+  }
+  pthread_mutex_unlock(&maint->lock);
+  return NULL;
+}
+
+/**
+ * Starts a worker.
+ * @param pass the housekeeping pass to run over and over
+ * @param arg passed to pass
+ * @param budget percent of one CPU to use at most (0 for the default)
+ * @param nice nice value for the worker, or MAINT_IDLE for SCHED_IDLE
+ * @return a pointer to the running worker, or NULL if it couldn't start
+ */
+ts_maint_t *maint_start(int (*pass)(void*), void *arg, int budget, int nice) {
+  ts_maint_t *maint = (ts_maint_t*) calloc(1, sizeof(ts_maint_t));
+  maint->pass = pass;
+  maint->arg = arg;
+  maint->budget = budget > 0 && budget <= 100 ? budget : MAINT_DEFAULT_BUDGET;
+  maint->nice = nice;
+  pthread_mutex_init(&maint->lock, NULL);
+  pthread_cond_init(&maint->wake, NULL);
+  if (pthread_create(&maint->thread, NULL, run, maint) != 0) {
+    pthread_mutex_destroy(&maint->lock);
+    pthread_cond_destroy(&maint->wake);
+    free(maint);
+    return NULL;
+  }
+  return maint;
+}
+
+/**
+ * Cuts the worker's current sleep short, e.g. when a resize is wanted.
+ */
+void maint_wake(ts_maint_t *maint) {
+  pthread_mutex_lock(&maint->lock);
+  pthread_cond_signal(&maint->wake);
+  pthread_mutex_unlock(&maint->lock);
+}
+
+/**
+ * Stops the worker, waits for its current pass to finish, and frees it.
+ */
+void maint_stop(ts_maint_t *maint) {
+  pthread_mutex_lock(&maint->lock);
+  maint->stop = 1;
+  pthread_cond_signal(&maint->wake);
+  pthread_mutex_unlock(&maint->lock);
+  pthread_join(maint->thread, NULL);
+  pthread_mutex_destroy(&maint->lock);
+  pthread_cond_destroy(&maint->wake);
+  free(maint);
+}
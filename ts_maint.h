@@ -0,0 +1,44 @@
+/*
+ * ts_maint.h
+ *
+ * A background worker that runs a map's deferred housekeeping in passes,
+ * under a CPU-time budget and at a lower scheduling priority than the
+ * threads calling get/put/del. After every pass it sleeps long enough that
+ * the CPU time it used stays within budget percent of one core.
+ */
+
+#ifndef TS_MAINT_H_
+#define TS_MAINT_H_
+
+#include <pthread.h>
+
+// default share of one CPU the worker may use, in percent
+#define MAINT_DEFAULT_BUDGET 10
+
+// nice value that puts the worker in SCHED_IDLE instead
+#define MAINT_IDLE 20
+
+// how long the worker sleeps after a pass that found nothing to do
+#define MAINT_IDLE_NS 10000000L
+
+// A worker: the pass it runs and its argument, its budget and priority,
+// and what it has done so far. pass returns how much work it did; zero
+// means there was nothing to do.
+typedef struct ts_maint_t {
+   pthread_t thread;
+   int (*pass)(void*);
+   void *arg;
+   int budget;
+   int nice;
+   int stop;
+   long passes;
+   double cpuSeconds;
+   pthread_mutex_t lock;
+   pthread_cond_t wake;
+} ts_maint_t;
+
+ts_maint_t *maint_start(int (*)(void*), void*, int, int);
+void maint_wake(ts_maint_t*);
+void maint_stop(ts_maint_t*);
+
+#endif /* TS_MAINT_H_ */
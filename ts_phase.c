@@ -0,0 +1,208 @@
+#include <limits.h>
+#include <stdlib.h>
+#include "ts_phase.h"
+#include "ts_simd.h"
+
+static uint64_t pack(int key, int value) {
+  return ((uint64_t) (uint32_t) key << 32) | (uint32_t) value;
+}
+
+static int key_of(uint64_t slot) {
+  return (int) (slot >> 32);
+}
+
+static int value_of(uint64_t slot) {
+  return (int) (uint32_t) slot;
+}
+
+static uint64_t load_slot(ts_phase_t *table, int i) {
+  return __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+}
+
+/**
+ * The slot a key's probe sequence starts at.
+ */
+static int home(ts_phase_t *table, int key) {
+  return hash_murmur(key) & (table->numSlots - 1);
+}
+
+static int next(ts_phase_t *table, int i) {
+  return (i + 1) & (table->numSlots - 1);
+}
+
+static int prev(ts_phase_t *table, int i) {
+  return (i - 1) & (table->numSlots - 1);
+}
+
+/**
+ * Whether slot a comes before slot b, going around the table. Runs never
+ * wrap more than halfway since the table is at most half full.
+ */
+static int less_index(ts_phase_t *table, int a, int b) {
+  return a < b ? 2 * (b - a) < table->numSlots : 2 * (a - b) > table->numSlots;
+}
+
+/**
+ * Creates an empty table. It doesn't grow: it has twice as many slots as
+ * it's meant to hold, which keeps the probe runs short.
+ * @param maxKeys the most keys the table will hold at once
+ * @return a pointer to a new table
+ */
+ts_phase_t *phase_init(int maxKeys) {
+  ts_phase_t *table = (ts_phase_t*) malloc(sizeof(ts_phase_t));
+  table->numSlots = 2;
+  while (table->numSlots < 2 * maxKeys) {
+    table->numSlots <<= 1;
+  }
+  table->slots = (uint64_t*) malloc(table->numSlots * sizeof(uint64_t));
+  for (int i = 0; i < table->numSlots; i++) {
+    table->slots[i] = pack(INT_MIN, 0);
+  }
+  return table;
+}
+
+/**
+ * Inserts a key during an insert phase. Walking from the key's home, it
+ * passes larger keys and takes the first slot holding a smaller one (or
+ * nothing); a smaller key it pushes out carries on down the table the same
+ * way. If the key is already there, the smaller of the two values is kept,
+ * so the outcome doesn't depend on which insert came first.
+ * @param table the table
+ * @param key the key (anything but INT_MIN)
+ * @param value its value
+ */
+void phase_insert(ts_phase_t *table, int key, int value) {
+  uint64_t carried = pack(key, value);
+  int i = home(table, key);
+  while (1) {
+    uint64_t curr = load_slot(table, i);
+    if (key_of(curr) == key) {
+      if (value_of(carried) >= value_of(curr)
+          || __atomic_compare_exchange_n(&table->slots[i], &curr, carried, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+      }
+    } else if (key_of(curr) > key) {
+      i = next(table, i);
+    } else if (__atomic_compare_exchange_n(&table->slots[i], &curr, carried, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      if (key_of(curr) == INT_MIN) {
+        return;
+      }
+      // the key we displaced goes on looking for a place
+      carried = curr;
+      key = key_of(curr);
+      i = next(table, i);
+    }
+  }
+}
+
+/**
+ * Looks a key up during a find phase. The walk stops at the first key
+ * smaller than the one it's looking for, so a miss is as cheap as a hit.
+ * @param table the table
+ * @param key the key to search
+ * @return the key's value, or INT_MAX if key not found
+ */
+int phase_find(ts_phase_t *table, int key) {
+  int i = home(table, key);
+  while (1) {
+    uint64_t curr = __atomic_load_n(&table->slots[i], __ATOMIC_RELAXED);
+    if (key_of(curr) == key) {
+      return value_of(curr);
+    }
+    if (key_of(curr) < key) {
+      return INT_MAX;
+    }
+    i = next(table, i);
+  }
+}
+
+/**
+ * Deletes a key during a delete phase. The key's slot is refilled with
+ * the nearest key further down the run that is allowed to move up to it
+ * (or left empty if there is none), and that key is then deleted from
+ * where it was, and so on to the end of the run. Slots only ever change
+ * to smaller keys while deletes run, which is what lets a delete notice
+ * keys that others moved underneath it.
+ * @param table the table
+ * @param key the key to delete
+ */
+void phase_delete(ts_phase_t *table, int key) {
+  int i = home(table, key);
+  int j = i;
+  uint64_t curr = load_slot(table, j);
+  if (key_of(curr) == INT_MIN) {
+    return;
+  }
+  while (key_of(curr) > key) {
+    j = next(table, j);
+    curr = load_slot(table, j);
+  }
+  while (1) {
+    // if the key is still in the table, it's at j or before it
+    if (key_of(curr) != key) {
+      if (j == i) {
+        return;
+      }
+      j = prev(table, j);
+      curr = load_slot(table, j);
+      continue;
+    }
+    // find the first slot after j that is empty or holds a key whose home
+    // isn't past j; then look back over the slots skipped, in case someone
+    // moved such a key into one of them meanwhile
+    int from = next(table, j);
+    uint64_t fill = load_slot(table, from);
+    while (key_of(fill) != INT_MIN && less_index(table, j, home(table, key_of(fill)))) {
+      from = next(table, from);
+      fill = load_slot(table, from);
+    }
+    for (int k = prev(table, from); k != j; k = prev(table, k)) {
+      uint64_t slot = load_slot(table, k);
+      if (key_of(slot) == INT_MIN || !less_index(table, j, home(table, key_of(slot)))) {
+        fill = slot;
+        from = k;
+      }
+    }
+    if (__atomic_compare_exchange_n(&table->slots[j], &curr, fill, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      if (key_of(fill) == INT_MIN) {
+        return;
+      }
+      // the key that moved up is in the table twice now; delete the
+      // copy it moved from
+      key = key_of(fill);
+      j = from;
+      i = home(table, key);
+    }
+    curr = load_slot(table, j);
+  }
+}
+
+/**
+ * Lists the table's contents in slot order. Since the layout only depends
+ * on which keys are in the table, so does the list. Call it between phases.
+ * @param table the table
+ * @param keys where to store the keys (room for maxKeys is enough)
+ * @param values where to store their values (may be NULL)
+ * @return the number of keys
+ */
+int phase_elements(ts_phase_t *table, int *keys, int *values) {
+  int n = 0;
+  for (int i = 0; i < table->numSlots; i++) {
+    if (key_of(table->slots[i]) != INT_MIN) {
+      keys[n] = key_of(table->slots[i]);
+      if (values != NULL) {
+        values[n] = value_of(table->slots[i]);
+      }
+      n++;
+    }
+  }
+  return n;
+}
+
+/**
+ * Frees the table.
+ */
+void phase_free(ts_phase_t *table) {
+  free(table->slots);
+  free(table);
+}
@@ -0,0 +1,34 @@
+/*
+ * ts_phase.h
+ *
+ * Phase-concurrent deterministic hash table, after Shun and Blelloch. It is
+ * a linear-probing table kept in priority order (larger keys first along
+ * each probe sequence), which makes its layout depend only on the set of
+ * keys it holds, never on the order or interleaving of the operations that
+ * built it. Any number of threads may run operations at once as long as
+ * they're all of one type: a phase of inserts, then a phase of finds, then
+ * a phase of deletes, with the caller's own barrier between phases. Inserts
+ * and deletes need nothing but compare-and-swap, and finds are plain loads.
+ */
+
+#ifndef TS_PHASE_H_
+#define TS_PHASE_H_
+
+#include <stdint.h>
+
+// A slot packs a key (high half) and its value (low half) into one word
+// so both change with one CAS. INT_MIN is the empty key, so it can't be
+// stored, and it sorts below every real key.
+typedef struct ts_phase_t {
+   uint64_t *slots;
+   int numSlots;
+} ts_phase_t;
+
+ts_phase_t *phase_init(int);
+void phase_insert(ts_phase_t*, int, int);
+int phase_find(ts_phase_t*, int);
+void phase_delete(ts_phase_t*, int);
+int phase_elements(ts_phase_t*, int*, int*);
+void phase_free(ts_phase_t*);
+
+#endif /* TS_PHASE_H_ */
@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ts_epoch.h"
+#include "ts_hashmap.h"
+#include "ts_registry.h"
+
+/**
+ * One pass of a worker: runs the maintenance pass of every map handed to
+ * it. Maps can't leave the registry while the pass holds the lock shared.
+ * @return how much work the maps' passes did
+ */
+static int registry_pass(void *arg) {
+  ts_worker_t *worker = (ts_worker_t*) arg;
+  ts_registry_t *registry = worker->registry;
+  int work = 0;
+  pthread_rwlock_rdlock(&registry->lock);
+  for (int i = 0; i < registry->numMembers; i++) {
+    ts_member_t *member = &registry->members[i];
+    if (member->worker == worker->index && member->pass != NULL) {
+      work += member->pass(member->map);
+    }
+  }
+  pthread_rwlock_unlock(&registry->lock);
+  return work;
+}
+
+/**
+ * Creates a registry with no maps in it yet and starts its workers.
+ * @param opts the budget, number of workers and their CPU budget and nice value
+ * @return a pointer to the new registry
+ */
+ts_registry_t *registry_init(const ts_registry_options_t *opts) {
+  ts_registry_t *registry = (ts_registry_t*) calloc(1, sizeof(ts_registry_t));
+  registry->pools = (ts_pool_t*) aligned_alloc(64, REGISTRY_SLABS * sizeof(ts_pool_t));
+  for (int i = 0; i < REGISTRY_SLABS; i++) {
+    slab_init(&registry->pools[i].slab, sizeof(ts_entry_t));
+    lock_init(&registry->pools[i].lock, TS_LOCK_MUTEX);
+  }
+  pthread_rwlock_init(&registry->lock, NULL);
+  registry->budget = opts->budget;
+  int workers = opts->workers > 0 ? opts->workers : REGISTRY_DEFAULT_WORKERS;
+  registry->workers = (ts_worker_t*) calloc(workers, sizeof(ts_worker_t));
+  for (int i = 0; i < workers; i++) {
+    ts_worker_t *worker = &registry->workers[registry->numWorkers];
+    worker->registry = registry;
+    worker->index = registry->numWorkers;
+    worker->maint = maint_start(registry_pass, worker, opts->maintBudget, opts->maintNice);
+    // maps just share fewer workers if some didn't start
+    if (worker->maint != NULL) {
+      registry->numWorkers++;
+    }
+  }
+  return registry;
+}
+
+/**
+ * Adds a map to the registry, handing it to the next worker if it has a
+ * maintenance pass.
+ * @param pass the map's maintenance pass, or NULL if it doesn't want one
+ * @return the index of the worker that runs pass, or -1 if there is none
+ */
+int registry_add(ts_registry_t *registry, ts_hashmap_t *map, int (*pass)(void*)) {
+  pthread_rwlock_wrlock(&registry->lock);
+  if (registry->numMembers == registry->maxMembers) {
+    registry->maxMembers = registry->maxMembers > 0 ? 2 * registry->maxMembers : 16;
+    registry->members = (ts_member_t*) realloc(registry->members, registry->maxMembers * sizeof(ts_member_t));
+  }
+  int worker = -1;
+  if (pass != NULL && registry->numWorkers > 0) {
+    worker = registry->nextWorker++ % registry->numWorkers;
+  }
+  ts_member_t *member = &registry->members[registry->numMembers++];
+  member->map = map;
+  member->pass = worker >= 0 ? pass : NULL;
+  member->worker = worker;
+  registry->created++;
+  pthread_rwlock_unlock(&registry->lock);
+  return worker;
+}
+
+/**
+ * Takes a map out of the registry. Waits for a pass that may be working
+ * on it, so none runs on it once this returns.
+ */
+void registry_remove(ts_registry_t *registry, ts_hashmap_t *map) {
+  pthread_rwlock_wrlock(&registry->lock);
+  for (int i = 0; i < registry->numMembers; i++) {
+    if (registry->members[i].map == map) {
+      registry->members[i] = registry->members[--registry->numMembers];
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&registry->lock);
+}
+
+/**
+ * Picks the first of the shared slabs a new map allocates from; stripe i
+ * of the map uses the i-th one after it, so maps spread over all of them.
+ * @param stripes the number of stripes the map has
+ */
+int registry_pool(ts_registry_t *registry, int stripes) {
+  return (unsigned) __atomic_fetch_add(&registry->nextPool, stripes, __ATOMIC_RELAXED) % REGISTRY_SLABS;
+}
+
+/**
+ * Allocates an entry from one of the shared slabs, next to near if that's
+ * one of the slab's and its page has room (see slab_alloc).
+ * @param pool which slab
+ */
+void *registry_alloc(ts_registry_t *registry, int pool, void *near) {
+  ts_pool_t *p = &registry->pools[pool % REGISTRY_SLABS];
+  lock_write(&p->lock);
+  void *entry = slab_alloc(&p->slab, near);
+  unlock(&p->lock);
+  return entry;
+}
+
+/**
+ * Charges a map for memory it has taken (or, with a negative amount,
+ * credits it for memory it has given back).
+ * @param memory the map's own count
+ * @param bytes how much
+ */
+void registry_charge(ts_registry_t *registry, long *memory, long bytes) {
+  __atomic_fetch_add(memory, bytes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&registry->used, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Whether taking this much more memory would go over the budget.
+ */
+int registry_full(ts_registry_t *registry, long bytes) {
+  return registry->budget > 0 && __atomic_load_n(&registry->used, __ATOMIC_RELAXED) + bytes > registry->budget;
+}
+
+/**
+ * Adds up the registry's maps and what its workers have done.
+ */
+void registry_stats(ts_registry_t *registry, ts_registry_stats_t *stats) {
+  memset(stats, 0, sizeof(ts_registry_stats_t));
+  pthread_rwlock_rdlock(&registry->lock);
+  stats->maps = registry->numMembers;
+  stats->created = registry->created;
+  for (int i = 0; i < registry->numMembers; i++) {
+    ts_hashmap_t *map = registry->members[i].map;
+    stats->size += __atomic_load_n(&map->size, __ATOMIC_RELAXED);
+    stats->ops += __atomic_load_n(&map->numOps, __ATOMIC_RELAXED);
+  }
+  pthread_rwlock_unlock(&registry->lock);
+  stats->memory = __atomic_load_n(&registry->used, __ATOMIC_RELAXED);
+  stats->budget = registry->budget;
+  for (int i = 0; i < registry->numWorkers; i++) {
+    stats->passes += registry->workers[i].maint->passes;
+    stats->cpuSeconds += registry->workers[i].maint->cpuSeconds;
+  }
+}
+
+/**
+ * Stops the workers and frees the registry with its shared slabs. Every
+ * map created in it has to have been freed first.
+ * @return 0, or EBUSY if the registry still has maps
+ */
+int registry_free(ts_registry_t *registry) {
+  if (registry->numMembers > 0) {
+    return EBUSY;
+  }
+  for (int i = 0; i < registry->numWorkers; i++) {
+    maint_stop(registry->workers[i].maint);
+  }
+  free(registry->workers);
+  // entries retired to a slab have to be released before its pages go
+  epoch_barrier();
+  for (int i = 0; i < REGISTRY_SLABS; i++) {
+    slab_destroy(&registry->pools[i].slab);
+    lock_destroy(&registry->pools[i].lock);
+  }
+  free(registry->pools);
+  free(registry->members);
+  pthread_rwlock_destroy(&registry->lock);
+  free(registry);
+  return 0;
+}
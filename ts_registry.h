@@ -0,0 +1,103 @@
+/*
+ * ts_registry.h
+ *
+ * A registry for running many small maps side by side, say one per
+ * tenant. Maps created in a registry (see initmap_in) take their entries
+ * from slabs the registry shares between all of them instead of from
+ * malloc, are looked after by the registry's maintenance workers instead
+ * of a thread each, and are charged for their table and entries against
+ * one memory budget for the lot. Freeing such a map hands its entries back
+ * to the shared slabs, so memory stays pooled as tenants come and go.
+ */
+
+#ifndef TS_REGISTRY_H_
+#define TS_REGISTRY_H_
+
+#include <pthread.h>
+#include "ts_lock.h"
+#include "ts_maint.h"
+#include "ts_slab.h"
+
+// shared slabs, each behind its own lock; a map's stripes spread over them
+#define REGISTRY_SLABS 64
+
+// default number of maintenance workers
+#define REGISTRY_DEFAULT_WORKERS 1
+
+// default number of lock stripes for a map created in a registry
+#define REGISTRY_DEFAULT_STRIPES 4
+
+// Options for creating a registry: the memory budget in bytes for all of
+// its maps together (0 for none), the number of maintenance workers (0 for
+// default), and each worker's CPU budget and nice value (see ts_maint.h)
+typedef struct ts_registry_options_t {
+   long budget;
+   int workers;
+   int maintBudget;
+   int maintNice;
+} ts_registry_options_t;
+
+// A shared slab and the lock its allocations take (frees don't)
+typedef struct ts_pool_t {
+   ts_slab_t slab;
+   ts_lock_t lock;
+} __attribute__((aligned(64))) ts_pool_t;
+
+// One of a map's entries in the registry: the map, the maintenance pass
+// to run on it, and which worker runs it
+typedef struct ts_member_t {
+   struct ts_hashmap_t *map;
+   int (*pass)(void*);
+   int worker;
+} ts_member_t;
+
+// A maintenance worker and the registry it works for
+typedef struct ts_worker_t {
+   struct ts_registry_t *registry;
+   int index;
+   ts_maint_t *maint;
+} ts_worker_t;
+
+// A registry: its shared slabs, its maps (guarded by lock; workers hold it
+// shared for a pass), its workers, and the budget and how much of it the
+// maps use. nextWorker and nextPool hand workers and slabs out round-robin.
+typedef struct ts_registry_t {
+   ts_pool_t *pools;
+   pthread_rwlock_t lock;
+   ts_member_t *members;
+   int numMembers;
+   int maxMembers;
+   ts_worker_t *workers;
+   int numWorkers;
+   int nextWorker;
+   int nextPool;
+   long budget;
+   long used;
+   long created;
+} ts_registry_t;
+
+// What a registry's maps add up to: how many there are and have been
+// created, their entries and operations, the memory they're charged for
+// and the budget, and what the maintenance workers have done
+typedef struct ts_registry_stats_t {
+   int maps;
+   long created;
+   long size;
+   long ops;
+   long memory;
+   long budget;
+   long passes;
+   double cpuSeconds;
+} ts_registry_stats_t;
+
+ts_registry_t *registry_init(const ts_registry_options_t*);
+int registry_add(ts_registry_t*, struct ts_hashmap_t*, int (*)(void*));
+void registry_remove(ts_registry_t*, struct ts_hashmap_t*);
+int registry_pool(ts_registry_t*, int);
+void *registry_alloc(ts_registry_t*, int, void*);
+void registry_charge(ts_registry_t*, long*, long);
+int registry_full(ts_registry_t*, long);
+void registry_stats(ts_registry_t*, ts_registry_stats_t*);
+int registry_free(ts_registry_t*);
+
+#endif /* TS_REGISTRY_H_ */
@@ -0,0 +1,255 @@
+#include <immintrin.h>
+#include "ts_simd.h"
+
+// Every kernel below comes in four versions, one per level. The wider
+// versions handle whole vectors and hand any leftover tail to the scalar
+// version, so each of them is exactly as correct as the reference.
+
+/*
+ * Scalar reference versions
+ */
+
+static void hash_batch_scalar(const int *keys, int *buckets, int n, int capacity) {
+  for (int i = 0; i < n; i++) {
+    buckets[i] = (unsigned) keys[i] % (unsigned) capacity;
+  }
+}
+
+static void mult_batch_scalar(const int *keys, int *buckets, int n, unsigned mask) {
+  for (int i = 0; i < n; i++) {
+    buckets[i] = hash_mult(keys[i]) & mask;
+  }
+}
+
+static void murmur_batch_scalar(const int *keys, int *buckets, int n, unsigned mask) {
+  for (int i = 0; i < n; i++) {
+    buckets[i] = hash_murmur(keys[i]) & mask;
+  }
+}
+
+/*
+ * SSE4.2 versions (4 keys per step, 2 for hash_batch)
+ */
+
+// The modulo is done in double precision: every 32-bit key and the
+// quotient are exact there, and one correction step fixes the rounding.
+__attribute__((target("sse4.2")))
+static void hash_batch_sse42(const int *keys, int *buckets, int n, int capacity) {
+  __m128d cap = _mm_set1_pd((double) capacity);
+  __m128d inv = _mm_set1_pd(1.0 / capacity);
+  __m128d wrap = _mm_set1_pd(4294967296.0);
+  __m128d zero = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i k = _mm_loadl_epi64((const __m128i*) &keys[i]);
+    // reinterpret the keys as unsigned: add 2^32 to the negative ones
+    __m128d d = _mm_cvtepi32_pd(k);
+    d = _mm_sub_pd(d, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srai_epi32(k, 31)), wrap));
+    __m128d q = _mm_floor_pd(_mm_mul_pd(d, inv));
+    __m128d r = _mm_sub_pd(d, _mm_mul_pd(q, cap));
+    r = _mm_add_pd(r, _mm_and_pd(_mm_cmplt_pd(r, zero), cap));
+    r = _mm_sub_pd(r, _mm_and_pd(_mm_cmpge_pd(r, cap), cap));
+    _mm_storel_epi64((__m128i*) &buckets[i], _mm_cvttpd_epi32(r));
+  }
+  hash_batch_scalar(keys + i, buckets + i, n - i, capacity);
+}
+
+__attribute__((target("sse4.2")))
+static void mult_batch_sse42(const int *keys, int *buckets, int n, unsigned mask) {
+  __m128i golden = _mm_set1_epi32(0x9e3779b1);
+  __m128i m = _mm_set1_epi32(mask);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i h = _mm_mullo_epi32(_mm_loadu_si128((const __m128i*) &keys[i]), golden);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    _mm_storeu_si128((__m128i*) &buckets[i], _mm_and_si128(h, m));
+  }
+  mult_batch_scalar(keys + i, buckets + i, n - i, mask);
+}
+
+__attribute__((target("sse4.2")))
+static void murmur_batch_sse42(const int *keys, int *buckets, int n, unsigned mask) {
+  __m128i c1 = _mm_set1_epi32(0x85ebca6b);
+  __m128i c2 = _mm_set1_epi32(0xc2b2ae35);
+  __m128i m = _mm_set1_epi32(mask);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i h = _mm_loadu_si128((const __m128i*) &keys[i]);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    h = _mm_mullo_epi32(h, c1);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+    h = _mm_mullo_epi32(h, c2);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    _mm_storeu_si128((__m128i*) &buckets[i], _mm_and_si128(h, m));
+  }
+  murmur_batch_scalar(keys + i, buckets + i, n - i, mask);
+}
+
+/*
+ * AVX2 versions (8 keys per step, 4 for hash_batch)
+ */
+
+__attribute__((target("avx2")))
+static void hash_batch_avx2(const int *keys, int *buckets, int n, int capacity) {
+  __m256d cap = _mm256_set1_pd((double) capacity);
+  __m256d inv = _mm256_set1_pd(1.0 / capacity);
+  __m256d wrap = _mm256_set1_pd(4294967296.0);
+  __m256d zero = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i k = _mm_loadu_si128((const __m128i*) &keys[i]);
+    __m256d d = _mm256_cvtepi32_pd(k);
+    d = _mm256_sub_pd(d, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_srai_epi32(k, 31)), wrap));
+    __m256d q = _mm256_floor_pd(_mm256_mul_pd(d, inv));
+    __m256d r = _mm256_sub_pd(d, _mm256_mul_pd(q, cap));
+    r = _mm256_add_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, zero, _CMP_LT_OQ), cap));
+    r = _mm256_sub_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, cap, _CMP_GE_OQ), cap));
+    _mm_storeu_si128((__m128i*) &buckets[i], _mm256_cvttpd_epi32(r));
+  }
+  hash_batch_scalar(keys + i, buckets + i, n - i, capacity);
+}
+
+__attribute__((target("avx2")))
+static void mult_batch_avx2(const int *keys, int *buckets, int n, unsigned mask) {
+  __m256i golden = _mm256_set1_epi32(0x9e3779b1);
+  __m256i m = _mm256_set1_epi32(mask);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i h = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*) &keys[i]), golden);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    _mm256_storeu_si256((__m256i*) &buckets[i], _mm256_and_si256(h, m));
+  }
+  mult_batch_scalar(keys + i, buckets + i, n - i, mask);
+}
+
+__attribute__((target("avx2")))
+static void murmur_batch_avx2(const int *keys, int *buckets, int n, unsigned mask) {
+  __m256i c1 = _mm256_set1_epi32(0x85ebca6b);
+  __m256i c2 = _mm256_set1_epi32(0xc2b2ae35);
+  __m256i m = _mm256_set1_epi32(mask);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i h = _mm256_loadu_si256((const __m256i*) &keys[i]);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, c1);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, c2);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    _mm256_storeu_si256((__m256i*) &buckets[i], _mm256_and_si256(h, m));
+  }
+  murmur_batch_scalar(keys + i, buckets + i, n - i, mask);
+}
+
+/*
+ * AVX-512 versions (16 keys per step, 8 for hash_batch)
+ */
+
+__attribute__((target("avx512f")))
+static void hash_batch_avx512(const int *keys, int *buckets, int n, int capacity) {
+  __m512d cap = _mm512_set1_pd((double) capacity);
+  __m512d inv = _mm512_set1_pd(1.0 / capacity);
+  __m512d zero = _mm512_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i k = _mm256_loadu_si256((const __m256i*) &keys[i]);
+    __m512d d = _mm512_cvtepu32_pd(k);
+    __m512d q = _mm512_roundscale_pd(_mm512_mul_pd(d, inv), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_sub_pd(d, _mm512_mul_pd(q, cap));
+    r = _mm512_mask_add_pd(r, _mm512_cmp_pd_mask(r, zero, _CMP_LT_OQ), r, cap);
+    r = _mm512_mask_sub_pd(r, _mm512_cmp_pd_mask(r, cap, _CMP_GE_OQ), r, cap);
+    _mm256_storeu_si256((__m256i*) &buckets[i], _mm512_cvttpd_epi32(r));
+  }
+  hash_batch_scalar(keys + i, buckets + i, n - i, capacity);
+}
+
+__attribute__((target("avx512f")))
+static void mult_batch_avx512(const int *keys, int *buckets, int n, unsigned mask) {
+  __m512i golden = _mm512_set1_epi32(0x9e3779b1);
+  __m512i m = _mm512_set1_epi32(mask);
+  for (int i = 0; i < n; i += 16) {
+    __mmask16 valid = n - i >= 16 ? 0xffff : (__mmask16) ((1u << (n - i)) - 1);
+    __m512i h = _mm512_mullo_epi32(_mm512_maskz_loadu_epi32(valid, &keys[i]), golden);
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+    _mm512_mask_storeu_epi32(&buckets[i], valid, _mm512_and_si512(h, m));
+  }
+}
+
+__attribute__((target("avx512f")))
+static void murmur_batch_avx512(const int *keys, int *buckets, int n, unsigned mask) {
+  __m512i c1 = _mm512_set1_epi32(0x85ebca6b);
+  __m512i c2 = _mm512_set1_epi32(0xc2b2ae35);
+  __m512i m = _mm512_set1_epi32(mask);
+  for (int i = 0; i < n; i += 16) {
+    __mmask16 valid = n - i >= 16 ? 0xffff : (__mmask16) ((1u << (n - i)) - 1);
+    __m512i h = _mm512_maskz_loadu_epi32(valid, &keys[i]);
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+    h = _mm512_mullo_epi32(h, c1);
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+    h = _mm512_mullo_epi32(h, c2);
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+    _mm512_mask_storeu_epi32(&buckets[i], valid, _mm512_and_si512(h, m));
+  }
+}
+
+/*
+ * Dispatch
+ */
+
+static const ts_kernels_t kernels[SIMD_LEVELS] = {
+  { "scalar", hash_batch_scalar, mult_batch_scalar, murmur_batch_scalar },
+  { "sse4.2", hash_batch_sse42, mult_batch_sse42, murmur_batch_sse42 },
+  { "avx2", hash_batch_avx2, mult_batch_avx2, murmur_batch_avx2 },
+  { "avx512", hash_batch_avx512, mult_batch_avx512, murmur_batch_avx512 },
+};
+
+/**
+ * Finds the widest instruction set level this CPU supports.
+ * @return one of the SIMD_* levels
+ */
+int simd_level() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return SIMD_SSE42;
+  }
+  return SIMD_SCALAR;
+}
+
+/**
+ * Gets one specific implementation of the kernels, for validating the
+ * vector versions against the scalar reference or benchmarking them.
+ * @param level one of the SIMD_* levels
+ * @return the kernels for that level, or NULL if this CPU can't run them
+ */
+const ts_kernels_t *simd_kernels(int level) {
+  if (level < 0 || level > simd_level()) {
+    return NULL;
+  }
+  return &kernels[level];
+}
+
+// The ifunc resolvers run while the dynamic linker is still relocating
+// the library, before the kernels table is safe to read, so they pick
+// the function directly.
+#define RESOLVER(kernel) \
+  static void *resolve_##kernel() { \
+    switch (simd_level()) { \
+      case SIMD_AVX512: return (void*) kernel##_avx512; \
+      case SIMD_AVX2: return (void*) kernel##_avx2; \
+      case SIMD_SSE42: return (void*) kernel##_sse42; \
+      default: return (void*) kernel##_scalar; \
+    } \
+  }
+
+RESOLVER(hash_batch)
+RESOLVER(mult_batch)
+RESOLVER(murmur_batch)
+
+void hash_batch(const int*, int*, int, int) __attribute__((ifunc("resolve_hash_batch")));
+void mult_batch(const int*, int*, int, unsigned) __attribute__((ifunc("resolve_mult_batch")));
+void murmur_batch(const int*, int*, int, unsigned) __attribute__((ifunc("resolve_murmur_batch")));
@@ -0,0 +1,58 @@
+/*
+ * ts_simd.h
+ *
+ * Vector hash kernels used by the map's batch paths, each built for
+ * several instruction sets. The plain entry points are bound once, when the
+ * program loads, to the widest version the host CPU supports; the scalar
+ * version of each kernel is the reference the others are checked against.
+ */
+
+#ifndef TS_SIMD_H_
+#define TS_SIMD_H_
+
+// instruction set levels, narrowest first
+#define SIMD_SCALAR 0
+#define SIMD_SSE42 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+#define SIMD_LEVELS 4
+
+// Multiplicative (Fibonacci) hash: one multiply by 2^32 / golden ratio,
+// then the high half folded down so the low bits can be used as an index
+static inline unsigned hash_mult(int key) {
+  unsigned h = (unsigned) key * 0x9e3779b1u;
+  return h ^ (h >> 16);
+}
+
+// MurmurHash3's 32-bit finalizer: slower than hash_mult, but every input
+// bit affects every output bit
+static inline unsigned hash_murmur(int key) {
+  unsigned h = (unsigned) key;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+// One implementation of every kernel:
+//   hash_batch  - bucket index ((unsigned) key % capacity) for n keys
+//   mult_batch  - bucket index (hash_mult(key) & mask) for n keys
+//   murmur_batch - bucket index (hash_murmur(key) & mask) for n keys
+typedef struct ts_kernels_t {
+   const char *name;
+   void (*hash_batch)(const int*, int*, int, int);
+   void (*mult_batch)(const int*, int*, int, unsigned);
+   void (*murmur_batch)(const int*, int*, int, unsigned);
+} ts_kernels_t;
+
+int simd_level();
+const ts_kernels_t *simd_kernels(int);
+
+// dispatched to the best level at load time
+void hash_batch(const int*, int*, int, int);
+void mult_batch(const int*, int*, int, unsigned);
+void murmur_batch(const int*, int*, int, unsigned);
+
+#endif /* TS_SIMD_H_ */
@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "ts_slab.h"
+
+// nodes start one cache line into the page, after the header
+#define SLAB_HEADER 64
+
+static slab_page_t *page_of(void *node) {
+  return (slab_page_t*) ((uintptr_t) node & ~(uintptr_t) (SLAB_PAGE - 1));
+}
+
+/**
+ * Sets up an empty slab; it gets its first page on the first allocation.
+ * @param slab the slab
+ * @param size the size of a node (at least a pointer)
+ */
+void slab_init(ts_slab_t *slab, int size) {
+  slab->partial = NULL;
+  slab->bump = NULL;
+  slab->end = NULL;
+  slab->pages = NULL;
+  slab->size = size < (int) sizeof(void*) ? (int) sizeof(void*) : size;
+  slab->numPages = 0;
+}
+
+/**
+ * Starts a new page; whatever was left of the last one is abandoned.
+ */
+static void new_page(ts_slab_t *slab) {
+  slab_page_t *page = (slab_page_t*) aligned_alloc(SLAB_PAGE, SLAB_PAGE);
+  page->slab = slab;
+  page->next = slab->pages;
+  page->free = NULL;
+  page->listed = 0;
+  page->nextPartial = NULL;
+  slab->pages = page;
+  slab->numPages++;
+  slab->bump = (char*) page + SLAB_HEADER;
+  slab->end = (char*) page + SLAB_PAGE;
+}
+
+/**
+ * Takes a freed node off a page, if it has one. Only the slab's owner
+ * takes nodes, so the pop can't be fooled by a node leaving and coming
+ * back while it looks.
+ */
+static void *take(slab_page_t *page) {
+  void *node = __atomic_load_n(&page->free, __ATOMIC_ACQUIRE);
+  while (node != NULL
+      && !__atomic_compare_exchange_n(&page->free, &node, *(void**) node, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+  }
+  return node;
+}
+
+/**
+ * Puts a page that has freed nodes on its slab's partial stack, unless
+ * it's there already.
+ */
+static void list_page(slab_page_t *page) {
+  if (__atomic_exchange_n(&page->listed, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  ts_slab_t *slab = page->slab;
+  slab_page_t *head = __atomic_load_n(&slab->partial, __ATOMIC_RELAXED);
+  do {
+    page->nextPartial = head;
+  } while (!__atomic_compare_exchange_n(&slab->partial, &head, page, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Allocates a node, as close to another one as it can: a freed node on
+ * near's page, else a freed node on some other page, else the next unused
+ * one of the newest page. Callers serialize allocations from one slab.
+ * @param slab the slab
+ * @param near a node of this slab to allocate next to, or NULL
+ * @return a pointer to the node
+ */
+void *slab_alloc(ts_slab_t *slab, void *near) {
+  void *node;
+  if (near != NULL && page_of(near)->slab == slab && (node = take(page_of(near))) != NULL) {
+    return node;
+  }
+  slab_page_t *page;
+  while ((page = __atomic_load_n(&slab->partial, __ATOMIC_ACQUIRE)) != NULL) {
+    if ((node = take(page)) != NULL) {
+      return node;
+    }
+    // emptied: drop it from the stack (unless a page was pushed on top
+    // meanwhile; then try that one), and put it back if a free raced in
+    if (!__atomic_compare_exchange_n(&slab->partial, &page, page->nextPartial, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    __atomic_store_n(&page->listed, 0, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&page->free, __ATOMIC_SEQ_CST) != NULL) {
+      list_page(page);
+    }
+  }
+  return slab_alloc_run(slab, 1);
+}
+
+/**
+ * Allocates n nodes that sit next to each other, from unused space only.
+ * Each one is freed on its own like any other node.
+ * @param slab the slab
+ * @param n how many nodes; at most slab_run_max()
+ * @return a pointer to the first node
+ */
+void *slab_alloc_run(ts_slab_t *slab, int n) {
+  if (slab->bump == NULL || slab->end - slab->bump < (long) n * slab->size) {
+    new_page(slab);
+  }
+  void *node = slab->bump;
+  slab->bump += (long) n * slab->size;
+  return node;
+}
+
+/**
+ * The longest run slab_alloc_run() can hand out.
+ */
+int slab_run_max(ts_slab_t *slab) {
+  return (SLAB_PAGE - SLAB_HEADER) / slab->size;
+}
+
+/**
+ * Gives a node back to its page. Safe from any thread, and usable as an
+ * epoch_retire() callback.
+ * @param node the node
+ */
+void slab_free(void *node) {
+  slab_page_t *page = page_of(node);
+  void *head = __atomic_load_n(&page->free, __ATOMIC_RELAXED);
+  do {
+    *(void**) node = head;
+  } while (!__atomic_compare_exchange_n(&page->free, &head, node, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+  if (!__atomic_load_n(&page->listed, __ATOMIC_SEQ_CST)) {
+    list_page(page);
+  }
+}
+
+/**
+ * Releases every page of a slab, whatever is still allocated from it.
+ */
+void slab_destroy(ts_slab_t *slab) {
+  slab_page_t *page = slab->pages;
+  while (page != NULL) {
+    slab_page_t *next = page->next;
+    free(page);
+    page = next;
+  }
+  slab->pages = NULL;
+}
@@ -0,0 +1,48 @@
+/*
+ * ts_slab.h
+ *
+ * A small slab allocator for fixed-size nodes, so nodes that are used
+ * together can live together. A TS_LOCALITY map gives each lock stripe a
+ * slab, and allocates a new entry on the page of the chain it's joining
+ * whenever that page has room, so a chain stays on a page or two instead
+ * of spreading across the heap. Allocation is done under the owner's
+ * lock; frees can come from any thread (they're usually epoch callbacks)
+ * and go back to their page without one.
+ */
+
+#ifndef TS_SLAB_H_
+#define TS_SLAB_H_
+
+// size (and alignment) of a slab page; a node finds its page by masking
+#define SLAB_PAGE 4096
+
+// A page starts with this header; its nodes follow. free is a stack of
+// the page's freed nodes, and listed says whether the page is on its
+// slab's stack of pages with free nodes.
+typedef struct slab_page_t {
+   struct ts_slab_t *slab;
+   struct slab_page_t *next;
+   void *free;
+   int listed;
+   struct slab_page_t *nextPartial;
+} slab_page_t;
+
+// A slab: its pages that have had nodes freed, the unused tail of its
+// newest page, and all of its pages so they can be released together
+typedef struct ts_slab_t {
+   slab_page_t *partial;
+   char *bump;
+   char *end;
+   slab_page_t *pages;
+   int size;
+   int numPages;
+} __attribute__((aligned(64))) ts_slab_t;
+
+void slab_init(ts_slab_t*, int);
+void *slab_alloc(ts_slab_t*, void*);
+void *slab_alloc_run(ts_slab_t*, int);
+int slab_run_max(ts_slab_t*);
+void slab_free(void*);
+void slab_destroy(ts_slab_t*);
+
+#endif /* TS_SLAB_H_ */
@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ts_split.h"
+
+/**
+ * Creates a split with one slot per CPU.
+ * @param numSlots number of slots, normally the number of CPUs
+ * @return a pointer to a new split
+ */
+ts_split_t *split_create(int numSlots) {
+  ts_split_t *split = (ts_split_t*) aligned_alloc(64,
+      sizeof(ts_split_t) + numSlots * sizeof(ts_split_slot_t));
+  memset(split, 0, sizeof(ts_split_t) + numSlots * sizeof(ts_split_slot_t));
+  split->numSlots = numSlots;
+  return split;
+}
+
+/**
+ * Adds to the calling CPU's slot. The caller must check closed afterwards
+ * and take the increment back out with split_take if it is set.
+ * @param split a pointer to the split
+ * @param delta the amount to add
+ * @return the slot the increment went to
+ */
+int split_add(ts_split_t *split, int delta) {
+  int cpu = sched_getcpu();
+  int slot = cpu >= 0 ? cpu % split->numSlots : 0;
+  // seq_cst so that either the adder sees closed or the drain sees this
+  __atomic_fetch_add(&split->slots[slot].sum, delta, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&split->slots[slot].adds, 1, __ATOMIC_RELAXED);
+  return slot;
+}
+
+/**
+ * Empties one slot.
+ * @return what the slot held
+ */
+long split_take(ts_split_t *split, int slot) {
+  return __atomic_exchange_n(&split->slots[slot].sum, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Adds up every slot. Increments that race with the sum may or may not be
+ * counted, as if they happened just after or just before it.
+ */
+long split_sum(ts_split_t *split) {
+  long sum = 0;
+  for (int i = 0; i < split->numSlots; i++) {
+    sum += __atomic_load_n(&split->slots[i].sum, __ATOMIC_RELAXED);
+  }
+  return sum;
+}
+
+/**
+ * Counts the increments made through the split so far.
+ */
+long split_adds(ts_split_t *split) {
+  long adds = 0;
+  for (int i = 0; i < split->numSlots; i++) {
+    adds += __atomic_load_n(&split->slots[i].adds, __ATOMIC_RELAXED);
+  }
+  return adds;
+}
+
+/**
+ * Empties every slot once the split has been closed.
+ * @return the total taken out
+ */
+long split_drain(ts_split_t *split) {
+  long sum = 0;
+  for (int i = 0; i < split->numSlots; i++) {
+    sum += split_take(split, i);
+  }
+  return sum;
+}
@@ -0,0 +1,71 @@
+/*
+ * ts_split.h
+ *
+ * Per-core sub-values for write-hot keys. When fetch_add traffic on one
+ * key keeps colliding on its stripe lock, the entry gets a split: one
+ * padded slot per CPU that increments go to without any lock, while the
+ * entry's own value becomes the base the slots are added to. Readers
+ * combine base and slots. The split is folded back into the base when the
+ * key cools down.
+ */
+
+#ifndef TS_SPLIT_H_
+#define TS_SPLIT_H_
+
+#include "ts_hashmap.h"
+
+// most keys a map splits at once
+#define SPLIT_MAX_KEYS 8
+
+// One CPU's share of a split key: the sum of the increments made there,
+// and how many there were. Padded so CPUs don't share a line.
+typedef struct ts_split_slot_t {
+   long sum;
+   long adds;
+} __attribute__((aligned(64))) ts_split_slot_t;
+
+// A split key and the entry it belongs to. closed is set once the split
+// is being folded back, after which adders take their increment back out
+// of their slot and apply it under the lock instead. lastOps/lastAdds
+// remember the map's operation count and the key's adds when it was last
+// checked for cooling down.
+typedef struct ts_split_t {
+   ts_entry_t *entry;
+   int key;
+   int closed;
+   int numSlots;
+   int lastOps;
+   long lastAdds;
+   ts_split_slot_t slots[];
+} ts_split_t;
+
+// The keys a map currently has split. Slots are published and cleared
+// with atomic stores and read without a lock; lock serializes changes.
+typedef struct ts_hotkeys_t {
+   int count;
+   int cooling;
+   ts_split_t *splits[SPLIT_MAX_KEYS];
+   pthread_mutex_t lock;
+} ts_hotkeys_t;
+
+ts_split_t *split_create(int);
+int split_add(ts_split_t*, int);
+long split_take(ts_split_t*, int);
+long split_sum(ts_split_t*);
+long split_adds(ts_split_t*);
+long split_drain(ts_split_t*);
+
+/**
+ * Reads an entry's value, adding in its per-core sub-values if it's split.
+ * Called under the entry's stripe lock or inside an epoch.
+ */
+static inline int entry_value(ts_entry_t *entry) {
+  int value = __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+  ts_split_t *split = __atomic_load_n(&entry->split, __ATOMIC_ACQUIRE);
+  if (split != NULL) {
+    value = (int) (value + split_sum(split));
+  }
+  return value;
+}
+
+#endif /* TS_SPLIT_H_ */
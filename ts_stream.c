@@ -0,0 +1,259 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ts_stream.h"
+
+// records a dispatch pass pulls from the stream at a time
+#define DISPATCH_BATCH 64
+
+/**
+ * Creates a stream with one ring per stripe.
+ * @param numRings number of rings (one per lock stripe)
+ * @param capacity records per ring, rounded up to a power of two
+ * @return a pointer to a new stream
+ */
+ts_stream_t *stream_init(int numRings, int capacity) {
+  ts_stream_t *stream = (ts_stream_t*) aligned_alloc(64, sizeof(ts_stream_t));
+  memset(stream, 0, sizeof(ts_stream_t));
+  unsigned long size = 1;
+  while (size < (unsigned long) (capacity > 0 ? capacity : STREAM_DEFAULT_CAPACITY)) {
+    size <<= 1;
+  }
+  stream->rings = (ts_ring_t*) aligned_alloc(64, numRings * sizeof(ts_ring_t));
+  memset(stream->rings, 0, numRings * sizeof(ts_ring_t));
+  for (int i = 0; i < numRings; i++) {
+    stream->rings[i].records = (ts_change_t*) malloc(size * sizeof(ts_change_t));
+    stream->rings[i].mask = size - 1;
+  }
+  stream->numRings = numRings;
+  stream->nextSeq = 1;
+  stream->expected = 1;
+  pthread_mutex_init(&stream->consumerLock, NULL);
+  pthread_mutex_init(&stream->watchLock, NULL);
+  return stream;
+}
+
+/**
+ * Appends a change record to a stripe's ring. Called with the stripe's
+ * lock held, which makes the caller the ring's only producer. When the
+ * consumer has fallen a full ring behind, the record is dropped and
+ * counted rather than blocking the writer. A dropped record never takes a
+ * sequence number (the consumer only ever makes room, so a ring that has
+ * room here still has it below), which keeps the stream gap-free: a
+ * missing number is always a record that's still being written.
+ * @param stream a pointer to the stream
+ * @param ring the stripe whose ring to append to
+ * @param op TS_CHANGE_PUT or TS_CHANGE_DEL
+ * @param key the key that changed
+ * @param value the value written or removed
+ */
+void stream_append(ts_stream_t *stream, int ring, int op, int key, int value) {
+  ts_ring_t *r = &stream->rings[ring];
+  unsigned long head = r->head;
+  if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+    __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELEASE);
+    return;
+  }
+  unsigned long seq = __atomic_fetch_add(&stream->nextSeq, 1, __ATOMIC_RELAXED);
+  ts_change_t *record = &r->records[head & r->mask];
+  record->seq = seq;
+  record->op = op;
+  record->key = key;
+  record->value = value;
+  // publish the record to the consumer
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Frees the stream and its watches.
+ * @param stream a pointer to the stream
+ */
+void stream_free(ts_stream_t *stream) {
+  for (int i = 0; i < stream->numRings; i++) {
+    free(stream->rings[i].records);
+  }
+  free(stream->rings);
+  for (int i = 0; i < stream->numWatches; i++) {
+    free(stream->watches[i].keys);
+  }
+  free(stream->watches);
+  pthread_mutex_destroy(&stream->consumerLock);
+  pthread_mutex_destroy(&stream->watchLock);
+  free(stream);
+}
+
+/**
+ * Sums the records every ring has dropped so far.
+ */
+static unsigned long total_dropped(ts_stream_t *stream) {
+  unsigned long dropped = 0;
+  for (int i = 0; i < stream->numRings; i++) {
+    dropped += __atomic_load_n(&stream->rings[i].dropped, __ATOMIC_ACQUIRE);
+  }
+  return dropped;
+}
+
+/**
+ * Merges the rings into sequence order. Caller holds the consumer lock.
+ */
+static int read_locked(ts_stream_t *stream, ts_change_t *out, int max) {
+  int n = 0;
+  while (n < max) {
+    // find the ring whose oldest record comes first in the stream
+    ts_ring_t *best = NULL;
+    unsigned long bestSeq = ULONG_MAX;
+    for (int i = 0; i < stream->numRings; i++) {
+      ts_ring_t *r = &stream->rings[i];
+      if (r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+        unsigned long seq = r->records[r->tail & r->mask].seq;
+        if (seq < bestSeq) {
+          best = r;
+          bestSeq = seq;
+        }
+      }
+    }
+    // a gap is a record another stripe is still writing (dropped records
+    // never get a number); come back for it later
+    if (best == NULL || bestSeq != stream->expected) {
+      break;
+    }
+    out[n++] = best->records[best->tail & best->mask];
+    __atomic_store_n(&best->tail, best->tail + 1, __ATOMIC_RELEASE);
+    stream->expected = bestSeq + 1;
+  }
+  return n;
+}
+
+/**
+ * Reads the next change records, in sequence order. Sequence numbers are
+ * contiguous: a record lost to a full ring is dropped before it gets one,
+ * so it shows up in stream_lost() rather than as a gap.
+ * @param map a pointer to the map
+ * @param out where to store the records
+ * @param max the most records to read
+ * @return the number of records read, or -1 if the map has no stream
+ */
+int stream_read(ts_hashmap_t *map, ts_change_t *out, int max) {
+  if (map->stream == NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&map->stream->consumerLock);
+  int n = read_locked(map->stream, out, max);
+  pthread_mutex_unlock(&map->stream->consumerLock);
+  return n;
+}
+
+/**
+ * Counts the change records the consumer will never see, because a ring
+ * was full when they were written.
+ * @param map a pointer to the map
+ * @return the number of lost records
+ */
+unsigned long stream_lost(ts_hashmap_t *map) {
+  if (map->stream == NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&map->stream->consumerLock);
+  unsigned long lost = total_dropped(map->stream);
+  pthread_mutex_unlock(&map->stream->consumerLock);
+  return lost;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  int x = *(const int*) a;
+  int y = *(const int*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Registers a callback for changes to any of a set of keys. Callbacks run
+ * on the thread calling stream_dispatch() and must not watch or unwatch.
+ * @param map a pointer to the map
+ * @param keys the keys to watch
+ * @param numKeys how many keys there are
+ * @param notify called with each matching change record and arg
+ * @param arg passed through to notify
+ * @return an id for unwatch(), or -1 if the map has no stream
+ */
+int watch_keys(ts_hashmap_t *map, const int *keys, int numKeys, void (*notify)(const ts_change_t*, void*), void *arg) {
+  ts_stream_t *stream = map->stream;
+  if (stream == NULL) {
+    return -1;
+  }
+  int *sorted = (int*) malloc(numKeys * sizeof(int));
+  memcpy(sorted, keys, numKeys * sizeof(int));
+  qsort(sorted, numKeys, sizeof(int), compare_keys);
+  pthread_mutex_lock(&stream->watchLock);
+  stream->watches = (ts_watch_t*) realloc(stream->watches, (stream->numWatches + 1) * sizeof(ts_watch_t));
+  ts_watch_t *watch = &stream->watches[stream->numWatches++];
+  watch->id = stream->nextWatchId++;
+  watch->keys = sorted;
+  watch->numKeys = numKeys;
+  watch->notify = notify;
+  watch->arg = arg;
+  int id = watch->id;
+  pthread_mutex_unlock(&stream->watchLock);
+  return id;
+}
+
+/**
+ * Registers a callback for changes to a single key.
+ * @return an id for unwatch(), or -1 if the map has no stream
+ */
+int watch_key(ts_hashmap_t *map, int key, void (*notify)(const ts_change_t*, void*), void *arg) {
+  return watch_keys(map, &key, 1, notify, arg);
+}
+
+/**
+ * Removes a watch.
+ * @param map a pointer to the map
+ * @param id the id returned when the watch was registered
+ * @return 0 on success, or -1 if there is no such watch
+ */
+int unwatch(ts_hashmap_t *map, int id) {
+  ts_stream_t *stream = map->stream;
+  if (stream == NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&stream->watchLock);
+  for (int i = 0; i < stream->numWatches; i++) {
+    if (stream->watches[i].id == id) {
+      free(stream->watches[i].keys);
+      stream->watches[i] = stream->watches[--stream->numWatches];
+      pthread_mutex_unlock(&stream->watchLock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&stream->watchLock);
+  return -1;
+}
+
+/**
+ * Drains the stream and runs the matching watch callbacks for each record.
+ * @param map a pointer to the map
+ * @return the number of records consumed, or -1 if the map has no stream
+ */
+int stream_dispatch(ts_hashmap_t *map) {
+  ts_change_t batch[DISPATCH_BATCH];
+  int total = 0;
+  int n;
+  do {
+    n = stream_read(map, batch, DISPATCH_BATCH);
+    if (n < 0) {
+      return -1;
+    }
+    pthread_mutex_lock(&map->stream->watchLock);
+    for (int i = 0; i < n; i++) {
+      for (int w = 0; w < map->stream->numWatches; w++) {
+        ts_watch_t *watch = &map->stream->watches[w];
+        if (bsearch(&batch[i].key, watch->keys, watch->numKeys, sizeof(int), compare_keys) != NULL) {
+          watch->notify(&batch[i], watch->arg);
+        }
+      }
+    }
+    pthread_mutex_unlock(&map->stream->watchLock);
+    total += n;
+  } while (n == DISPATCH_BATCH);
+  return total;
+}
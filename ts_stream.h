@@ -0,0 +1,83 @@
+/*
+ * ts_stream.h
+ *
+ * Change-data-capture for a ts_hashmap_t created with TS_STREAM. Every
+ * put/del appends a change record to a ring buffer owned by the bucket's
+ * lock stripe; a consumer reads them back as one stream ordered by
+ * sequence number, or registers watches that are called for the keys they
+ * care about.
+ */
+
+#ifndef TS_STREAM_H_
+#define TS_STREAM_H_
+
+#include "ts_hashmap.h"
+
+// change record operations
+#define TS_CHANGE_PUT 1
+#define TS_CHANGE_DEL 2
+
+// default number of records each stripe's ring can hold
+#define STREAM_DEFAULT_CAPACITY 1024
+
+// A change record: its position in the stream, the operation, the key,
+// and the value written by a put or removed by a del
+typedef struct ts_change_t {
+   unsigned long seq;
+   int op;
+   int key;
+   int value;
+} ts_change_t;
+
+// A single-producer ring of change records. The producer is whoever holds
+// the stripe's lock; head and tail sit on separate cache lines so the
+// producer and the consumer don't fight over one. dropped counts the
+// records it had no room for, which never got a sequence number.
+typedef struct ts_ring_t {
+   unsigned long head __attribute__((aligned(64)));
+   unsigned long dropped;
+   unsigned long tail __attribute__((aligned(64)));
+   ts_change_t *records;
+   unsigned long mask;
+} ts_ring_t;
+
+// A watch: a sorted set of keys and the callback to run for their changes
+typedef struct ts_watch_t {
+   int id;
+   int *keys;
+   int numKeys;
+   void (*notify)(const ts_change_t*, void*);
+   void *arg;
+} ts_watch_t;
+
+// A stream is one ring per stripe, the next sequence number to hand out,
+// and the consumer's state: the next sequence number it expects and the
+// registered watches. nextSeq is the one cache line every writer touches;
+// it's a single fetch-and-add, on a line of its own, and what gives the
+// stripes' records one order.
+typedef struct ts_stream_t {
+   unsigned long nextSeq __attribute__((aligned(64)));
+   ts_ring_t *rings __attribute__((aligned(64)));
+   int numRings;
+   pthread_mutex_t consumerLock;
+   unsigned long expected;
+   pthread_mutex_t watchLock;
+   ts_watch_t *watches;
+   int numWatches;
+   int nextWatchId;
+} ts_stream_t;
+
+// used by the map
+ts_stream_t *stream_init(int, int);
+void stream_append(ts_stream_t*, int, int, int, int);
+void stream_free(ts_stream_t*);
+
+// consumer API
+int stream_read(ts_hashmap_t*, ts_change_t*, int);
+unsigned long stream_lost(ts_hashmap_t*);
+int watch_keys(ts_hashmap_t*, const int*, int, void (*)(const ts_change_t*, void*), void*);
+int watch_key(ts_hashmap_t*, int, void (*)(const ts_change_t*, void*), void*);
+int unwatch(ts_hashmap_t*, int);
+int stream_dispatch(ts_hashmap_t*);
+
+#endif /* TS_STREAM_H_ */
@@ -0,0 +1,139 @@
+#include <stddef.h>
+#include <stdio.h>
+#include "ts_tune.h"
+
+// runs per trial; the best one counts, which filters out scheduler noise
+#define TUNE_REPEATS 2
+
+// how much faster (in percent) a candidate has to be to replace the best
+#define TUNE_MARGIN 2
+
+// how many values each dimension can take at most
+#define TUNE_MAX_VALUES 4
+
+static const char *hashNames[] = { "modulo", "mult", "murmur" };
+
+// backends the search may add to the flags the caller asks for, one at a
+// time: online resizing and optimistic reads, lock-free gets, and bucket
+// heads on their stripe lock's cache line
+#define TUNE_BACKENDS (TS_ADAPTIVE | TS_RCU | TS_COLOCATE)
+
+// One dimension of the search: which ts_options_t field it sets and the
+// values it tries. Capacities are filled in from the workload's key range.
+typedef struct dimension_t {
+  size_t offset;
+  int values[TUNE_MAX_VALUES];
+  int numValues;
+} dimension_t;
+
+/**
+ * Measures one configuration: a fresh, prefilled map per run, best run wins.
+ * @return operations per second
+ */
+static double trial(const ts_workload_t *wl, const ts_options_t *opts) {
+  double best = 0;
+  for (int i = 0; i < TUNE_REPEATS; i++) {
+    bench_result_t result;
+    ts_hashmap_t *map = initmap_opts(opts);
+    bench_prefill(map, wl);
+    bench_run(map, wl, &result);
+    freeMap(map);
+    if (result.opsPerSec > best) {
+      best = result.opsPerSec;
+    }
+  }
+  return best;
+}
+
+/**
+ * Prints a configuration on one line.
+ */
+void print_options(const ts_options_t *opts) {
+  printf("capacity=%d stripes=%d lock=%s hash=%s", opts->capacity, opts->numStripes,
+      lock_name(opts->lockType), hashNames[opts->hash]);
+  if (opts->flags & TS_ADAPTIVE) printf(" +adaptive");
+  if (opts->flags & TS_RCU) printf(" +rcu");
+  if (opts->flags & TS_COLOCATE) printf(" +colocate");
+}
+
+/**
+ * Searches for the fastest map configuration for a workload. The search
+ * is coordinate descent: starting from the defaults, it sweeps capacity,
+ * stripe count, lock type, hash function and backend one at a time,
+ * keeping any value that beats the best so far by TUNE_MARGIN percent, and
+ * repeats the sweep while something improves (at most twice). A backend is
+ * the caller's flags plus at most one of TUNE_BACKENDS.
+ * @param wl the workload to tune for; long ones are shortened per trial
+ * @param flags TS_* flags every candidate map must have
+ * @param best where to store the winning configuration
+ * @param verbose whether to print every trial
+ * @return the winning configuration's operations per second
+ */
+double autotune(const ts_workload_t *wl, int flags, ts_options_t *best, int verbose) {
+  ts_workload_t trialWl = *wl;
+  if (trialWl.trace != NULL && trialWl.traceLen > (long) TUNE_TRIAL_OPS * trialWl.threads) {
+    trialWl.traceLen = (long) TUNE_TRIAL_OPS * trialWl.threads;
+  } else if (trialWl.opsPerThread > TUNE_TRIAL_OPS) {
+    trialWl.opsPerThread = TUNE_TRIAL_OPS;
+  }
+  int keys = wl->keyRange > 64 ? wl->keyRange : 64;
+  dimension_t dims[] = {
+    { offsetof(ts_options_t, capacity), { keys / 4, keys / 2, keys, keys * 2 }, 4 },
+    { offsetof(ts_options_t, numStripes), { 16, 64, 256, 1024 }, 4 },
+    { offsetof(ts_options_t, lockType), { TS_LOCK_MUTEX, TS_LOCK_SPIN, TS_LOCK_RW, TS_LOCK_BRAVO }, TS_LOCK_TYPES },
+    { offsetof(ts_options_t, hash), { TS_HASH_MODULO, TS_HASH_MULT, TS_HASH_MURMUR }, 3 },
+    { offsetof(ts_options_t, flags), { flags, flags | TS_ADAPTIVE, flags | TS_RCU, flags | TS_COLOCATE }, 4 },
+  };
+  int numDims = sizeof(dims) / sizeof(dims[0]);
+
+  ts_options_t current = { .capacity = keys, .numStripes = 64, .flags = flags };
+  double bestScore = trial(&trialWl, &current);
+  if (verbose) {
+    print_options(&current);
+    printf("  %.0f ops/s (start)\n", bestScore);
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    int improved = 0;
+    for (int d = 0; d < numDims; d++) {
+      int *field = (int*) ((char*) &current + dims[d].offset);
+      int start = *field;
+      int keep = start;
+      for (int v = 0; v < dims[d].numValues; v++) {
+        if (dims[d].values[v] == start) {
+          continue;
+        }
+        ts_options_t candidate = current;
+        *(int*) ((char*) &candidate + dims[d].offset) = dims[d].values[v];
+        double score = trial(&trialWl, &candidate);
+        if (verbose) {
+          print_options(&candidate);
+          printf("  %.0f ops/s\n", score);
+        }
+        if (score > bestScore * (100 + TUNE_MARGIN) / 100) {
+          bestScore = score;
+          keep = dims[d].values[v];
+          improved = 1;
+        }
+      }
+      *field = keep;
+    }
+    if (!improved) {
+      break;
+    }
+  }
+  *best = current;
+  return bestScore;
+}
+
+/**
+ * Creates a map configured by the autotuner for the given workload. Tuning
+ * runs the workload several times, so this takes a few seconds.
+ * @param wl the workload the map will serve
+ * @param flags TS_* flags for the map
+ * @return a pointer to a new thread-safe hashmap.
+ */
+ts_hashmap_t *initmap_tuned(const ts_workload_t *wl, int flags) {
+  ts_options_t best;
+  autotune(wl, flags, &best, 0);
+  return initmap_opts(&best);
+}
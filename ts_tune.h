@@ -0,0 +1,21 @@
+/*
+ * ts_tune.h
+ *
+ * Workload-driven autotuner: measures candidate map configurations against
+ * a workload with the benchmark harness and keeps the fastest.
+ */
+
+#ifndef TS_TUNE_H_
+#define TS_TUNE_H_
+
+#include "bench.h"
+#include "ts_hashmap.h"
+
+// operations per thread in each trial run; longer workloads are cut short
+#define TUNE_TRIAL_OPS 50000
+
+double autotune(const ts_workload_t*, int, ts_options_t*, int);
+ts_hashmap_t *initmap_tuned(const ts_workload_t*, int);
+void print_options(const ts_options_t*);
+
+#endif /* TS_TUNE_H_ */
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "ts_tune.h"
+
+/**
+ * Recommends a map configuration for a workload, given either as a file
+ * (see bench_load) or as a synthetic mix on the command line.
+ */
+int main(int argc, char *argv[]) {
+	ts_workload_t wl = { 0 };
+	if (argc == 2) {
+		if (bench_load(argv[1], &wl) != 0) {
+			printf("Could not read workload %s\n", argv[1]);
+			return 1;
+		}
+	} else if (argc >= 5) {
+		wl.threads = atoi(argv[1]);
+		wl.keyRange = atoi(argv[2]);
+		wl.getPct = atoi(argv[3]);
+		wl.putPct = atoi(argv[4]);
+		wl.opsPerThread = TUNE_TRIAL_OPS;
+	} else {
+		printf("Usage: %s <workload file>\n", argv[0]);
+		printf("       %s <num threads> <max key> <get %%> <put %%>\n", argv[0]);
+		return 1;
+	}
+
+	ts_options_t best;
+	double score = autotune(&wl, 0, &best, 1);
+	printf("\nrecommended: ");
+	print_options(&best);
+	printf("  (%.0f ops/s)\n", score);
+	free(wl.trace);
+	return 0;
+}